@@ -0,0 +1,148 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+#include "KTreeConfig.h"
+
+#include "ktreelib.hpp"
+#include "timer.hpp"
+
+
+// latency below which a fraction p of the queries ran, nearest rank
+static double percentile(const std::vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0.0;
+	}
+	size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// fraction of the k true nearest neighbors found, averaged over the queries
+static double recall(const std::vector<KTREE::QueryRecord>& records, const KTREE::GroundTruth& groundtruth, size_t k) {
+	if (records.empty()) {
+		return 0.0;
+	}
+	double total = 0.0;
+	for (size_t i = 0; i < records.size(); i++) {
+		const KTREE::PointId *neighbors = groundtruth.neighbors(i);
+		std::unordered_set<KTREE::PointId> truth(neighbors, neighbors + k);
+		size_t found = 0;
+		for (KTREE::PointId id: records[i].ids) {
+			found += truth.count(id);
+		}
+		total += static_cast<double>(found) / k;
+	}
+	return total / records.size();
+}
+
+
+int main(int argc, char **argv) {
+	KTREE::Config *config = KTREE::Config::get_instance();
+	KTREE::Args args(argc, argv);
+	try {
+		args.parse(config);
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+
+		exit(1);
+	}
+
+	try {
+		if (config->search_mode == KTREE::SearchMode::RANGE) {
+			throw KTREE::KTreeError("The benchmark runs the nearest neighbor search modes");
+		}
+
+		KTREE::Index index;
+		index.load();
+
+		bool all = config->queries_size == 0;
+		KTREE::DataContainer *queries = KTREE::DataContainer::load_from_file(config->queries, all, config->queries_size);
+
+		// recall is only reported against a ground truth
+		KTREE::GroundTruth groundtruth;
+		bool has_groundtruth = !config->groundtruth.empty();
+		if (has_groundtruth) {
+			std::ifstream in(config->groundtruth, std::ios::binary);
+			if (!in.is_open()) {
+				throw KTREE::KTreeError("Failed to open ground truth file for reading");
+			}
+			groundtruth.deserialize(in);
+			if (groundtruth.get_k() < config->k || groundtruth.size() < queries->size()) {
+				throw KTREE::KTreeError("The ground truth has fewer neighbors or queries than the benchmark");
+			}
+		}
+
+		std::vector<KTREE::QueryRecord> records;
+		for (size_t run = 0; run < config->warmup; run++) {
+			index.run_queries(*queries, records);
+		}
+
+		std::vector<double> latencies;
+		double total_time = 0.0;
+		double recall_sum = 0.0;
+		size_t distance_computations = 0;
+		size_t leaves = 0;
+		Timer t;
+		for (size_t run = 0; run < config->repeats; run++) {
+			t.reset();
+			t.start();
+			index.run_queries(*queries, records);
+			t.stop();
+			total_time += t.seconds();
+			for (const KTREE::QueryRecord& record: records) {
+				latencies.push_back(record.time);
+				distance_computations += record.distance_computation;
+				leaves += record.leaf_count;
+			}
+			if (has_groundtruth) {
+				recall_sum += recall(records, groundtruth, config->k);
+			}
+		}
+		std::sort(latencies.begin(), latencies.end());
+
+		size_t num_queries = queries->size();
+		size_t answered = num_queries * config->repeats;
+		double mean = 0.0;
+		for (double latency: latencies) {
+			mean += latency;
+		}
+		mean = latencies.empty()? 0.0: mean / latencies.size();
+
+		// latencies in milliseconds
+		std::cout << "{" << std::endl;
+		std::cout << "  \"index\": \"" << config->index_path << "\"," << std::endl;
+		std::cout << "  \"queries\": \"" << config->queries << "\"," << std::endl;
+		std::cout << "  \"num_queries\": " << num_queries << "," << std::endl;
+		std::cout << "  \"k\": " << config->k << "," << std::endl;
+		std::cout << "  \"search_mode\": \"" << KTREE::search_mode_name(config->search_mode) << "\"," << std::endl;
+		std::cout << "  \"query_threads\": " << config->query_threads << "," << std::endl;
+		std::cout << "  \"warmup\": " << config->warmup << "," << std::endl;
+		std::cout << "  \"repeats\": " << config->repeats << "," << std::endl;
+		std::cout << "  \"recall\": ";
+		if (has_groundtruth) {
+			std::cout << recall_sum / config->repeats;
+		}
+		else {
+			std::cout << "null";
+		}
+		std::cout << "," << std::endl;
+		std::cout << "  \"qps\": " << (total_time > 0.0? answered / total_time: 0.0) << "," << std::endl;
+		std::cout << "  \"latency_ms\": {\"mean\": " << mean * 1e3
+			<< ", \"p50\": " << percentile(latencies, 0.5) * 1e3
+			<< ", \"p90\": " << percentile(latencies, 0.9) * 1e3
+			<< ", \"p99\": " << percentile(latencies, 0.99) * 1e3
+			<< ", \"p99.9\": " << percentile(latencies, 0.999) * 1e3 << "}," << std::endl;
+		std::cout << "  \"distance_computations\": " << (answered > 0? static_cast<double>(distance_computations) / answered: 0.0) << "," << std::endl;
+		std::cout << "  \"leaves_visited\": " << (answered > 0? static_cast<double>(leaves) / answered: 0.0) << std::endl;
+		std::cout << "}" << std::endl;
+
+		delete queries;
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
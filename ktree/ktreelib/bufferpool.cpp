@@ -0,0 +1,77 @@
+#include "bufferpool.hpp"
+
+
+namespace KTREE {
+
+BufferPool::BufferPool(size_t capacity): capacity(capacity), used(0), hits(0), misses(0), evictions(0) {}
+
+std::shared_ptr<const LeafBlock> BufferPool::get(const void *key, const std::function<LeafBlock*()>& load) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = lookup.find(key);
+		if (it != lookup.end()) {
+			hits++;
+			entries.splice(entries.begin(), entries, it->second);
+			return it->second->data;
+		}
+		misses++;
+	}
+
+	// the leaf is read without holding the lock, other queries
+	// keep hitting the pool in the meantime
+	std::shared_ptr<const LeafBlock> data(load());
+	size_t bytes = data->bytes();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = lookup.find(key);
+	if (it != lookup.end()) {
+		// loaded by another query at the same time
+		entries.splice(entries.begin(), entries, it->second);
+		return it->second->data;
+	}
+	entries.push_front({key, data, bytes});
+	lookup[key] = entries.begin();
+	used += bytes;
+	evict();
+	return data;
+}
+
+void BufferPool::evict() {
+	// the most recent entry is kept even when it alone exceeds the budget
+	while (used > capacity && entries.size() > 1) {
+		Entry& entry = entries.back();
+		used -= entry.bytes;
+		lookup.erase(entry.key);
+		entries.pop_back();
+		evictions++;
+	}
+}
+
+size_t BufferPool::get_used() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return used;
+}
+
+size_t BufferPool::get_hits() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return hits;
+}
+
+size_t BufferPool::get_misses() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return misses;
+}
+
+size_t BufferPool::get_evictions() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return evictions;
+}
+
+void BufferPool::clear() {
+	std::lock_guard<std::mutex> lock(mtx);
+	entries.clear();
+	lookup.clear();
+	used = 0;
+}
+
+};
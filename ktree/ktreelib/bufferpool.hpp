@@ -0,0 +1,61 @@
+#ifndef __BUFFERPOOL_HPP__
+#define __BUFFERPOOL_HPP__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+
+#include "data.hpp"
+
+namespace KTREE {
+
+// leaves loaded on first access and kept under a memory budget,
+// the least recently used leaves are evicted first. an evicted leaf
+// stays alive until the last query holding it releases it
+class BufferPool {
+private:
+	struct Entry {
+		const void *key;
+		std::shared_ptr<const LeafBlock> data;
+		size_t bytes;
+	};
+
+	// most recently used entry at the front
+	std::list<Entry> entries;
+	std::unordered_map<const void *, std::list<Entry>::iterator> lookup;
+	mutable std::mutex mtx;
+
+	size_t capacity;
+	size_t used;
+
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+
+	void evict();
+
+public:
+	// capacity in bytes
+	BufferPool(size_t capacity);
+	BufferPool(const BufferPool&) = delete;
+	~BufferPool() = default;
+
+	// the leaf identified by key, read with load on a miss, thread safe
+	std::shared_ptr<const LeafBlock> get(const void *key, const std::function<LeafBlock*()>& load);
+
+	size_t get_capacity() const {
+		return capacity;
+	}
+	size_t get_used() const;
+	size_t get_hits() const;
+	size_t get_misses() const;
+	size_t get_evictions() const;
+
+	void clear();
+};
+
+};
+
+#endif // __BUFFERPOOL_HPP__
@@ -15,11 +15,33 @@ static void print_usage() {
 	std::cout << "  --dataset <path>       Path to the dataset file" << std::endl;
 	std::cout << "  --queries <path>       Path to the queries file" << std::endl;
 	std::cout << "  --index <path>         Path to the index file" << std::endl;
+	std::cout << "  --groundtruth <path>   Path to the exact neighbors of the queries, written by the groundtruth mode" << std::endl;
 	std::cout << "  --dataset_size <size>  Number of points in the dataset to index" << std::endl;
 	std::cout << "  --queries_size <size>  Number of points in the queries to query" << std::endl;
 	std::cout << "  --dimensions <size>    Number of dimensions" << std::endl;
 	std::cout << "  --leaf_size <size>     Number of points in a leaf" << std::endl;
-	std::cout << "  --mode <mode>          Mode (index, query)" << std::endl;
+	std::cout << "  --top_k <size>         Number of highest variance dimensions used to pick the split segment" << std::endl;
+	std::cout << "  --fit_sample_size <size> Points of a node sampled to fit its split projection and median (0 uses every point)" << std::endl;
+	std::cout << "  --k <size>             Number of nearest neighbors to return per query" << std::endl;
+	std::cout << "  --mode <mode>          Mode (index, query, groundtruth)" << std::endl;
+	std::cout << "  --search_mode <mode>   Search mode (exact, eps, budget, topdown, range)" << std::endl;
+	std::cout << "  --epsilon <value>      Approximation factor of the eps search mode" << std::endl;
+	std::cout << "  --leaf_budget <size>   Maximum number of leaves visited by the budget search mode" << std::endl;
+	std::cout << "  --radius <value>       Distance to the query of the range search mode results" << std::endl;
+	std::cout << "  --query_threads <size> Number of threads answering queries" << std::endl;
+	std::cout << "  --scan_threads <size>  Number of threads scanning the leaves of a query" << std::endl;
+	std::cout << "  --build_threads <size> Number of threads splitting the nodes of a new index (0 uses every core)" << std::endl;
+	std::cout << "  --pin_threads          Bind every build thread to its own core" << std::endl;
+	std::cout << "  --leaf_storage <type>  Storage of the leaves of a new index (packed, files)" << std::endl;
+	std::cout << "  --leaf_codes <type>    Compressed codes scanned before the leaves of a new packed index (none, sq8, pq)" << std::endl;
+	std::cout << "  --pq_subspaces <size>  Number of subspaces, and bytes per point, of the pq codes" << std::endl;
+	std::cout << "  --rerank <size>        Candidates ranked by pq codes in the approximate search modes then re-ranked on the float vectors (0 returns the code distances)" << std::endl;
+	std::cout << "  --leaf_layout <type>   Layout of the leaves in memory (rows, grouped)" << std::endl;
+	std::cout << "  --buffer_size <size>   Memory for leaves loaded on demand, in MB (0 loads every leaf with the index)" << std::endl;
+	std::cout << "  --prefetch <size>      Number of frontier nodes whose leaves are read ahead of the search (0 disables)" << std::endl;
+	std::cout << "  --warmup <size>        Untimed passes over the queries before the benchmark" << std::endl;
+	std::cout << "  --repeats <size>       Timed passes over the queries of the benchmark" << std::endl;
+	std::cout << "  --stats <path>         File receiving the per query execution statistics, JSON if it ends with .json, CSV otherwise" << std::endl;
 	std::cout << "  --help                 Display this information" << std::endl;
 }
 
@@ -27,12 +49,53 @@ KTREE::Config::Config() {
 	dataset = "";
 	queries = "";
 	index_path = "";
+	groundtruth = "";
 	top_k = 5;
+	fit_sample_size = 0;
+	k = 1;
+	query_threads = 1;
+	scan_threads = 1;
+	build_threads = 0;
+	pin_threads = false;
 	dataset_size = 0;
 	queries_size = 0;
 	dimensions = 0;
 	leaf_size = 1;
 	mode = INDEX;
+	search_mode = EXACT;
+	epsilon = 0.0f;
+	leaf_budget = 0;
+	// unset, required by the range search mode
+	radius = -1.0f;
+	buffer_size = 0;
+	prefetch = 0;
+	leaf_storage = PACKED;
+	leaf_layout = ROWS;
+	leaf_codes = NO_CODES;
+	pq_subspaces = 8;
+	rerank = 0;
+	stats_path = "";
+	warmup = 1;
+	repeats = 3;
+}
+
+KTREE::Config *KTREE::Config::instance = nullptr;
+std::mutex KTREE::Config::mtx;
+
+const char* KTREE::search_mode_name(SearchMode search_mode) {
+	switch (search_mode) {
+		case EXACT:
+			return "exact";
+		case EPSILON:
+			return "eps";
+		case BUDGET:
+			return "budget";
+		case TOP_DOWN:
+			return "topdown";
+		case RANGE:
+			return "range";
+	}
+	return "unknown";
 }
 
 KTREE::Config *KTREE::Config::get_instance() {
@@ -58,17 +121,40 @@ void KTREE::Args::parse(Config *config)
 		{"dataset", required_argument, 0, 'd'},
 		{"queries", required_argument, 0, 'q'},
 		{"index", required_argument, 0, 'i'},
+		{"groundtruth", required_argument, 0, 'g'},
 		{"dataset_size", required_argument, 0, 'n'},
 		{"queries_size", required_argument, 0, 'm'},
 		{"dimensions", required_argument, 0, 'D'},
 		{"leaf_size", required_argument, 0, 'l'},
 		{"mode", required_argument, 0, 'x'},
 		{"top_k", required_argument, 0, 'k'},
-		{"help", no_argument, 0, '?'}
+		{"fit_sample_size", required_argument, 0, 'F'},
+		{"k", required_argument, 0, 'K'},
+		{"search_mode", required_argument, 0, 's'},
+		{"epsilon", required_argument, 0, 'e'},
+		{"leaf_budget", required_argument, 0, 'b'},
+		{"radius", required_argument, 0, 'r'},
+		{"query_threads", required_argument, 0, 't'},
+		{"scan_threads", required_argument, 0, 'T'},
+		{"build_threads", required_argument, 0, 'W'},
+		{"pin_threads", no_argument, 0, 'A'},
+		{"buffer_size", required_argument, 0, 'B'},
+		{"prefetch", required_argument, 0, 'P'},
+		{"leaf_storage", required_argument, 0, 'L'},
+		{"leaf_layout", required_argument, 0, 'y'},
+		{"leaf_codes", required_argument, 0, 'c'},
+		{"pq_subspaces", required_argument, 0, 'p'},
+		{"rerank", required_argument, 0, 'R'},
+		{"stats", required_argument, 0, 'S'},
+		{"warmup", required_argument, 0, 'w'},
+		{"repeats", required_argument, 0, 'N'},
+		{"help", no_argument, 0, '?'},
+		{0, 0, 0, 0}
 	};
 
 	int option_index = 0;
 	int tmp = 0;
+	float ftmp = 0.0f;
 	std::string mode = "";
 
 	while (true) {
@@ -85,6 +171,9 @@ void KTREE::Args::parse(Config *config)
 			case 'i':
 				config->index_path = optarg;
 				break;
+			case 'g':
+				config->groundtruth = optarg;
+				break;
 			case 'n':
 				tmp = atoi(optarg);
 				if (tmp <= 0) {
@@ -120,6 +209,8 @@ void KTREE::Args::parse(Config *config)
 					config->mode = INDEX;
 				} else if (mode == "query") {
 					config->mode = QUERY;
+				} else if (mode == "groundtruth") {
+					config->mode = GROUNDTRUTH;
 				} else {
 					throw KTREE::InvalidArguments<std::string>("mode", mode);
 				}
@@ -131,6 +222,162 @@ void KTREE::Args::parse(Config *config)
 				}
 				config->top_k = tmp;
 				break;
+			case 'F':
+				tmp = atoi(optarg);
+				if (tmp < 0) {
+					throw KTREE::InvalidArguments<int>("fit_sample_size", tmp);
+				}
+				config->fit_sample_size = tmp;
+				break;
+			case 's':
+				mode = optarg;
+				std::transform(mode.begin(), mode.end(), mode.begin(), [](unsigned char c){ return std::tolower(c); });
+				if (mode == "exact") {
+					config->search_mode = EXACT;
+				} else if (mode == "eps") {
+					config->search_mode = EPSILON;
+				} else if (mode == "budget") {
+					config->search_mode = BUDGET;
+				} else if (mode == "topdown") {
+					config->search_mode = TOP_DOWN;
+				} else if (mode == "range") {
+					config->search_mode = RANGE;
+				} else {
+					throw KTREE::InvalidArguments<std::string>("search_mode", mode);
+				}
+				break;
+			case 'e':
+				ftmp = atof(optarg);
+				if (ftmp < 0.0f) {
+					throw KTREE::InvalidArguments<float>("epsilon", ftmp);
+				}
+				config->epsilon = ftmp;
+				break;
+			case 'b':
+				tmp = atoi(optarg);
+				if (tmp <= 0) {
+					throw KTREE::InvalidArguments<int>("leaf_budget", tmp);
+				}
+				config->leaf_budget = tmp;
+				break;
+			case 'r':
+				ftmp = atof(optarg);
+				if (ftmp < 0.0f) {
+					throw KTREE::InvalidArguments<float>("radius", ftmp);
+				}
+				config->radius = ftmp;
+				break;
+			case 't':
+				tmp = atoi(optarg);
+				if (tmp <= 0) {
+					throw KTREE::InvalidArguments<int>("query_threads", tmp);
+				}
+				config->query_threads = tmp;
+				break;
+			case 'T':
+				tmp = atoi(optarg);
+				if (tmp <= 0) {
+					throw KTREE::InvalidArguments<int>("scan_threads", tmp);
+				}
+				config->scan_threads = tmp;
+				break;
+			case 'W':
+				tmp = atoi(optarg);
+				if (tmp < 0) {
+					throw KTREE::InvalidArguments<int>("build_threads", tmp);
+				}
+				config->build_threads = tmp;
+				break;
+			case 'A':
+				config->pin_threads = true;
+				break;
+			case 'B':
+				tmp = atoi(optarg);
+				if (tmp < 0) {
+					throw KTREE::InvalidArguments<int>("buffer_size", tmp);
+				}
+				config->buffer_size = tmp;
+				break;
+			case 'P':
+				tmp = atoi(optarg);
+				if (tmp < 0) {
+					throw KTREE::InvalidArguments<int>("prefetch", tmp);
+				}
+				config->prefetch = tmp;
+				break;
+			case 'L':
+				mode = optarg;
+				std::transform(mode.begin(), mode.end(), mode.begin(), [](unsigned char c){ return std::tolower(c); });
+				if (mode == "packed") {
+					config->leaf_storage = PACKED;
+				} else if (mode == "files") {
+					config->leaf_storage = FILES;
+				} else {
+					throw KTREE::InvalidArguments<std::string>("leaf_storage", mode);
+				}
+				break;
+			case 'y':
+				mode = optarg;
+				std::transform(mode.begin(), mode.end(), mode.begin(), [](unsigned char c){ return std::tolower(c); });
+				if (mode == "rows") {
+					config->leaf_layout = ROWS;
+				} else if (mode == "grouped") {
+					config->leaf_layout = GROUPED;
+				} else {
+					throw KTREE::InvalidArguments<std::string>("leaf_layout", mode);
+				}
+				break;
+			case 'c':
+				mode = optarg;
+				std::transform(mode.begin(), mode.end(), mode.begin(), [](unsigned char c){ return std::tolower(c); });
+				if (mode == "none") {
+					config->leaf_codes = NO_CODES;
+				} else if (mode == "sq8") {
+					config->leaf_codes = SQ8;
+				} else if (mode == "pq") {
+					config->leaf_codes = PQ;
+				} else {
+					throw KTREE::InvalidArguments<std::string>("leaf_codes", mode);
+				}
+				break;
+			case 'p':
+				tmp = atoi(optarg);
+				if (tmp <= 0) {
+					throw KTREE::InvalidArguments<int>("pq_subspaces", tmp);
+				}
+				config->pq_subspaces = tmp;
+				break;
+			case 'R':
+				tmp = atoi(optarg);
+				if (tmp < 0) {
+					throw KTREE::InvalidArguments<int>("rerank", tmp);
+				}
+				config->rerank = tmp;
+				break;
+			case 'S':
+				config->stats_path = optarg;
+				break;
+			case 'w':
+				tmp = atoi(optarg);
+				if (tmp < 0) {
+					throw KTREE::InvalidArguments<int>("warmup", tmp);
+				}
+				config->warmup = tmp;
+				break;
+			case 'N':
+				tmp = atoi(optarg);
+				if (tmp <= 0) {
+					throw KTREE::InvalidArguments<int>("repeats", tmp);
+				}
+				config->repeats = tmp;
+				break;
+			case 'K':
+				tmp = atoi(optarg);
+				if (tmp <= 0) {
+					throw KTREE::InvalidArguments<int>("k", tmp);
+				}
+				config->k = tmp;
+				break;
 
 			case '?':
 				print_usage();
@@ -143,6 +390,17 @@ void KTREE::Args::parse(Config *config)
 				break;
 		}
 	}
+
+	if (config->search_mode == BUDGET && config->leaf_budget == 0) {
+		throw KTREE::InvalidArguments<size_t>("leaf_budget", config->leaf_budget);
+	}
+	// codes are written next to the packed leaves
+	if (config->leaf_codes != NO_CODES && config->leaf_storage != PACKED) {
+		throw KTREE::InvalidArguments<std::string>("leaf_storage", "files");
+	}
+	if (config->search_mode == RANGE && config->radius < 0.0f) {
+		throw KTREE::InvalidArguments<float>("radius", config->radius);
+	}
 }
 
 void KTREE::Config::print()
@@ -150,16 +408,53 @@ void KTREE::Config::print()
 	std::cout << "dataset: " << dataset << std::endl;
 	std::cout << "queries: " << queries << std::endl;
 	std::cout << "index_path: " << index_path << std::endl;
+	std::cout << "groundtruth: " << groundtruth << std::endl;
 	std::cout << "dataset_size: " << dataset_size << std::endl;
 	std::cout << "queries_size: " << queries_size << std::endl;
 	std::cout << "dimensions: " << dimensions << std::endl;
 	std::cout << "leaf_size: " << leaf_size << std::endl;
 	std::cout << "top_k: " << top_k << std::endl;
-	if (mode == INDEX) {
-		std::cout << "mode: index" << std::endl;
-	} else {
-		std::cout << "mode: query" << std::endl;
+	std::cout << "fit_sample_size: " << fit_sample_size << std::endl;
+	std::cout << "k: " << k << std::endl;
+	std::cout << "query_threads: " << query_threads << std::endl;
+	std::cout << "scan_threads: " << scan_threads << std::endl;
+	std::cout << "build_threads: " << build_threads << std::endl;
+	std::cout << "pin_threads: " << (pin_threads? "yes": "no") << std::endl;
+	switch (mode) {
+		case INDEX:
+			std::cout << "mode: index" << std::endl;
+			break;
+		case QUERY:
+			std::cout << "mode: query" << std::endl;
+			break;
+		case GROUNDTRUTH:
+			std::cout << "mode: groundtruth" << std::endl;
+			break;
+	}
+	std::cout << "search_mode: " << search_mode_name(search_mode) << std::endl;
+	std::cout << "epsilon: " << epsilon << std::endl;
+	std::cout << "leaf_budget: " << leaf_budget << std::endl;
+	std::cout << "radius: " << radius << std::endl;
+	std::cout << "buffer_size: " << buffer_size << std::endl;
+	std::cout << "prefetch: " << prefetch << std::endl;
+	std::cout << "leaf_storage: " << (leaf_storage == PACKED? "packed": "files") << std::endl;
+	std::cout << "leaf_layout: " << (leaf_layout == GROUPED? "grouped": "rows") << std::endl;
+	switch (leaf_codes) {
+		case NO_CODES:
+			std::cout << "leaf_codes: none" << std::endl;
+			break;
+		case SQ8:
+			std::cout << "leaf_codes: sq8" << std::endl;
+			break;
+		case PQ:
+			std::cout << "leaf_codes: pq" << std::endl;
+			break;
 	}
+	std::cout << "pq_subspaces: " << pq_subspaces << std::endl;
+	std::cout << "rerank: " << rerank << std::endl;
+	std::cout << "stats: " << stats_path << std::endl;
+	std::cout << "warmup: " << warmup << std::endl;
+	std::cout << "repeats: " << repeats << std::endl;
 }
 
 void KTREE::Config::serialize(std::ofstream& out) const
@@ -168,6 +463,9 @@ void KTREE::Config::serialize(std::ofstream& out) const
 	KTREE::serialize(dimensions, out);
 	KTREE::serialize(leaf_size, out);
 	KTREE::serialize(top_k, out);
+	KTREE::serialize(leaf_storage, out);
+	KTREE::serialize(leaf_codes, out);
+	KTREE::serialize(pq_subspaces, out);
 
 }
 
@@ -178,5 +476,8 @@ void KTREE::Config::deserialize(std::ifstream& in)
 	KTREE::deserialize(dimensions, in);
 	KTREE::deserialize(leaf_size, in);
 	KTREE::deserialize(top_k, in);
+	KTREE::deserialize(leaf_storage, in);
+	KTREE::deserialize(leaf_codes, in);
+	KTREE::deserialize(pq_subspaces, in);
 	
 }
\ No newline at end of file
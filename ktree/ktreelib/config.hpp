@@ -12,6 +12,38 @@ namespace KTREE {
 enum Mode {
 	INDEX = 0,
 	QUERY = 1,
+	GROUNDTRUTH = 2,
+};
+
+enum SearchMode {
+	EXACT = 0,
+	TOP_DOWN = 1,
+	EPSILON = 2,
+	BUDGET = 3,
+	RANGE = 4,
+};
+
+// name of a search mode on the command line
+const char* search_mode_name(SearchMode search_mode);
+
+enum LeafLayout {
+	// point after point
+	ROWS = 0,
+	// groups of points stored dimension by dimension
+	GROUPED = 1,
+};
+
+enum LeafCodes {
+	NO_CODES = 0,
+	// 8 bit scalar quantization
+	SQ8 = 1,
+	// product quantization, one byte per subspace
+	PQ = 2,
+};
+
+enum LeafStorage {
+	FILES = 0,
+	PACKED = 1,
 };
 
 
@@ -21,12 +53,36 @@ public:
 	std::string dataset;
 	std::string queries;
 	std::string index_path;
+	std::string groundtruth;
 	unsigned int dataset_size;
 	unsigned int queries_size;
 	unsigned int dimensions;
 	unsigned int leaf_size;
 	size_t top_k;
+	// points of a node sampled to fit its split, 0 fits on every point
+	size_t fit_sample_size;
+	size_t k;
+	unsigned int query_threads;
+	unsigned int scan_threads;
+	// threads splitting the nodes of a new index, 0 uses every core
+	unsigned int build_threads;
+	bool pin_threads;
 	Mode mode;
+	SearchMode search_mode;
+	float epsilon;
+	size_t leaf_budget;
+	float radius;
+	size_t buffer_size;
+	size_t prefetch;
+	LeafStorage leaf_storage;
+	LeafLayout leaf_layout;
+	LeafCodes leaf_codes;
+	size_t pq_subspaces;
+	size_t rerank;
+	std::string stats_path;
+	// passes over the queries of the benchmark, untimed then timed
+	size_t warmup;
+	size_t repeats;
 
 	Config(const Config&) = delete;
 	static Config *get_instance();
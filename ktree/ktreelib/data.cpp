@@ -5,6 +5,9 @@
 #include "segmentation.hpp"
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 
 
 namespace KTREE {
@@ -173,5 +176,102 @@ void DataContainer::save_to_file(const std::string& filename) const {
 }
 
 
+std::string ids_file_name(const std::string& data_file) {
+	return data_file + ".ids";
+}
+
+// aligned storage for n floats, rounded up to whole alignment blocks
+static float* allocate_values(size_t n) {
+	size_t bytes = n * sizeof(float);
+	bytes = (bytes + LeafBlock::ALIGNMENT - 1) / LeafBlock::ALIGNMENT * LeafBlock::ALIGNMENT;
+	if (bytes == 0) {
+		bytes = LeafBlock::ALIGNMENT;
+	}
+	float *values = static_cast<float *>(std::aligned_alloc(LeafBlock::ALIGNMENT, bytes));
+	if (values == nullptr) {
+		throw std::bad_alloc();
+	}
+	return values;
+}
+
+LeafBlock::LeafBlock(const float *rows, const PointId *ids, size_t num_points, size_t dimensions):
+	values(const_cast<float *>(rows)), ids(ids), num_points(num_points), dimensions(dimensions), layout(ROWS), owner(false), codes(nullptr), code_errors(nullptr), code_size(0) {
+}
+
+LeafBlock::LeafBlock(const float *rows, const PointId *ids, size_t num_points, size_t dimensions, LeafLayout layout):
+	owned_ids(ids, ids + num_points), num_points(num_points), dimensions(dimensions), layout(layout), owner(true), codes(nullptr), code_errors(nullptr), code_size(0) {
+	this->ids = owned_ids.data();
+	if (layout == ROWS) {
+		values = allocate_values(num_points * dimensions);
+		std::memcpy(values, rows, num_points * dimensions * sizeof(float));
+		return;
+	}
+	// padding points get distances above any threshold
+	const size_t group_size = SIMD::POINT_GROUP;
+	values = allocate_values(num_groups() * group_size * dimensions);
+	for (size_t g = 0; g < num_groups(); g++) {
+		float *group_values = values + g * dimensions * group_size;
+		for (size_t p = 0; p < group_size; p++) {
+			size_t point = g * group_size + p;
+			for (size_t i = 0; i < dimensions; i++) {
+				group_values[i * group_size + p] = point < num_points?
+					rows[point * dimensions + i]: std::numeric_limits<float>::max();
+			}
+		}
+	}
+}
+
+LeafBlock::~LeafBlock() {
+	if (owner) {
+		std::free(values);
+	}
+}
+
+LeafBlock* LeafBlock::load_from_file(const std::string& file_path, LeafLayout layout) {
+	size_t dimensions = KTREE::Config::get_instance()->dimensions;
+	std::ifstream file(file_path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open the data file for reading");
+	}
+	file.seekg(0, std::ios::end);
+	size_t num_points = static_cast<size_t>(file.tellg()) / (dimensions * sizeof(float));
+	file.seekg(0, std::ios::beg);
+	std::vector<float> rows(num_points * dimensions);
+	file.read(reinterpret_cast<char*>(rows.data()), rows.size() * sizeof(float));
+	file.close();
+
+	std::ifstream ids_file(ids_file_name(file_path), std::ios::in | std::ios::binary);
+	if (!ids_file.is_open()) {
+		throw std::runtime_error("Could not open the ids file for reading");
+	}
+	std::vector<PointId> ids(num_points);
+	ids_file.read(reinterpret_cast<char*>(ids.data()), ids.size() * sizeof(PointId));
+	if (static_cast<size_t>(ids_file.gcount()) != ids.size() * sizeof(PointId)) {
+		throw std::runtime_error("Invalid number of ids in ids file");
+	}
+	return new LeafBlock(rows.data(), ids.data(), num_points, dimensions, layout);
+}
+
+void LeafBlock::set_codes(const uint8_t *codes, const float *code_errors, size_t code_size, bool copy) {
+	this->code_size = code_size;
+	if (!copy) {
+		this->codes = codes;
+		this->code_errors = code_errors;
+		return;
+	}
+	owned_codes.assign(codes, codes + num_points * code_size);
+	owned_code_errors.assign(code_errors, code_errors + num_points);
+	this->codes = owned_codes.data();
+	this->code_errors = owned_code_errors.data();
+}
+
+size_t LeafBlock::bytes() const {
+	size_t total = owned_codes.size() + owned_code_errors.size() * sizeof(float);
+	if (!owner) {
+		return total;
+	}
+	size_t num_values = layout == ROWS? num_points * dimensions: num_groups() * SIMD::POINT_GROUP * dimensions;
+	return total + num_values * sizeof(float) + num_points * sizeof(PointId);
+}
 
 };
\ No newline at end of file
@@ -2,9 +2,13 @@
 #define __DATA_HPP__
 
 #include <vector>
+#include <string>
+#include <cstdint>
 #include <Eigen/Dense>
 
 #include "segmentation.hpp"
+#include "config.hpp"
+#include "kernels.hpp"
 
 namespace KTREE {
 
@@ -50,6 +54,96 @@ public:
 
 };
 
+
+// position of a point in the indexed dataset
+typedef uint32_t PointId;
+
+// file holding the ids of the points of a data file
+std::string ids_file_name(const std::string& data_file);
+
+// points of a leaf in one contiguous block aligned on 64 bytes,
+// with their ids in a parallel array
+class LeafBlock {
+private:
+	float *values;
+	const PointId *ids;
+	std::vector<PointId> owned_ids;
+	size_t num_points;
+	size_t dimensions;
+	LeafLayout layout;
+	// false for a view of memory owned elsewhere
+	bool owner;
+
+	// optional codes of the points, code_size bytes per point, with
+	// the distance between each point and its reconstruction
+	const uint8_t *codes;
+	const float *code_errors;
+	size_t code_size;
+	std::vector<uint8_t> owned_codes;
+	std::vector<float> owned_code_errors;
+
+public:
+	static const size_t ALIGNMENT = 64;
+
+	// view of rows stored elsewhere, such as a mapped leaf store
+	LeafBlock(const float *rows, const PointId *ids, size_t num_points, size_t dimensions);
+	// copy of rows in the given layout
+	LeafBlock(const float *rows, const PointId *ids, size_t num_points, size_t dimensions, LeafLayout layout);
+	LeafBlock(const LeafBlock&) = delete;
+	~LeafBlock();
+
+	// reads a data file and its ids file
+	static LeafBlock* load_from_file(const std::string& file_path, LeafLayout layout);
+
+	size_t size() const {
+		return num_points;
+	}
+	size_t get_dimensions() const {
+		return dimensions;
+	}
+	LeafLayout get_layout() const {
+		return layout;
+	}
+
+	// point i of the rows layout
+	const float* row(size_t i) const {
+		return values + i * dimensions;
+	}
+
+	// number of groups of the grouped layout, the last one is
+	// padded with points far from any query
+	size_t num_groups() const {
+		return (num_points + SIMD::POINT_GROUP - 1) / SIMD::POINT_GROUP;
+	}
+	// group g of the grouped layout, value i of point p at [i * POINT_GROUP + p]
+	const float* group(size_t g) const {
+		return values + g * dimensions * SIMD::POINT_GROUP;
+	}
+
+	// attaches the codes of the points, copied or viewed
+	void set_codes(const uint8_t *codes, const float *code_errors, size_t code_size, bool copy);
+
+	bool has_codes() const {
+		return codes != nullptr;
+	}
+	const uint8_t* code(size_t i) const {
+		return codes + i * code_size;
+	}
+	float code_error(size_t i) const {
+		return code_errors[i];
+	}
+
+	const PointId* get_ids() const {
+		return ids;
+	}
+	PointId id(size_t i) const {
+		return ids[i];
+	}
+
+	// memory held by the block, 0 for a view
+	size_t bytes() const;
+};
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "groundtruth.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "io.hpp"
+#include "query.hpp"
+#include "kernels.hpp"
+#include "utils.hpp"
+#include "timer.hpp"
+
+#ifdef MULTITHREADED_ENABLED
+#include "threadpool.hpp"
+#endif
+
+
+namespace KTREE {
+
+void GroundTruth::compute(const std::string& dataset, size_t dataset_size, const std::string& queries, size_t queries_size, size_t dimensions, size_t k, size_t num_threads) {
+	Timer t;
+	t.start();
+
+	std::vector<float> query_points;
+	BlockReader query_reader(queries, dimensions, queries_size);
+	query_points.reserve(query_reader.size() * dimensions);
+	std::vector<float> block;
+	while (query_reader.next(block) > 0) {
+		query_points.insert(query_points.end(), block.begin(), block.end());
+	}
+	size_t num_queries = query_reader.size();
+
+	// the next block is read while this one is scanned
+	BlockReader reader(dataset, dimensions, dataset_size, BlockReader::BLOCK_BYTES, true);
+	this->k = std::min(k, reader.size());
+	std::vector<ResultContainer<>> results(num_queries, ResultContainer<>(this->k));
+
+	// each chunk of queries keeps its own results, no locking is needed
+	size_t num_chunks = std::max<size_t>(1, std::min(num_threads, num_queries));
+	size_t chunk_size = (num_queries + num_chunks - 1) / std::max<size_t>(1, num_chunks);
+	size_t tile_points = std::max<size_t>(1, TILE_BYTES / (dimensions * sizeof(float)));
+
+	LOG("GROUND TRUTH OF " << num_queries << " QUERIES OVER " << reader.size() << " POINTS")
+
+#ifdef MULTITHREADED_ENABLED
+	THREADS::ScanPool *pool = num_chunks > 1? new THREADS::ScanPool(num_chunks - 1): nullptr;
+#endif
+	size_t count;
+	while ((count = reader.next(block)) > 0) {
+		size_t first_id = reader.block_start();
+		auto scan_chunk = [&](size_t chunk) {
+			size_t first_query = chunk * chunk_size;
+			size_t last_query = std::min(num_queries, first_query + chunk_size);
+			// a tile of points is reused by every query of the chunk while in cache
+			for (size_t tile = 0; tile < count; tile += tile_points) {
+				size_t tile_end = std::min(count, tile + tile_points);
+				for (size_t q = first_query; q < last_query; q++) {
+					const float *query = query_points.data() + q * dimensions;
+					ResultContainer<>& result = results[q];
+					for (size_t p = tile; p < tile_end; p++) {
+						float distance = SIMD::squared_l2(query, block.data() + p * dimensions, dimensions, result.kth_distance());
+						result.insert(distance, static_cast<PointId>(first_id + p));
+					}
+				}
+			}
+		};
+#ifdef MULTITHREADED_ENABLED
+		if (pool != nullptr) {
+			pool->parallel_for(num_chunks, scan_chunk);
+			continue;
+		}
+#endif
+		scan_chunk(0);
+	}
+#ifdef MULTITHREADED_ENABLED
+	delete pool;
+#endif
+
+	ids.resize(num_queries * this->k);
+	distances.resize(num_queries * this->k);
+	for (size_t q = 0; q < num_queries; q++) {
+		std::vector<Result> sorted = results[q].sorted();
+		for (size_t i = 0; i < sorted.size(); i++) {
+			ids[q * this->k + i] = sorted[i].id;
+			distances[q * this->k + i] = sorted[i].distance;
+		}
+	}
+	t.stop();
+	LOG("GROUND TRUTH TIME: " << t.to_string())
+}
+
+void GroundTruth::save(const std::string& path) const {
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open()) {
+		throw std::runtime_error("Could not open the ground truth file for writing");
+	}
+	serialize(out);
+}
+
+void GroundTruth::serialize(std::ofstream& out) const {
+	KTREE::serialize(k, out);
+	KTREE::serialize(ids, out);
+	KTREE::serialize(distances, out);
+}
+
+void GroundTruth::deserialize(std::ifstream& in) {
+	KTREE::deserialize(k, in);
+	KTREE::deserialize(ids, in);
+	KTREE::deserialize(distances, in);
+}
+
+};
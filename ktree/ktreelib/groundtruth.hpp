@@ -0,0 +1,54 @@
+#ifndef __GROUNDTRUTH_HPP__
+#define __GROUNDTRUTH_HPP__
+
+#include <vector>
+#include <string>
+
+#include "data.hpp"
+#include "serialization.hpp"
+
+namespace KTREE {
+
+// exact k nearest neighbors of a batch of queries, found by a scan of the
+// whole dataset: the recall oracle of the approximate search modes and the
+// baseline the tree is measured against
+class GroundTruth: public Serializable {
+private:
+	size_t k;
+	// k neighbors per query, closest first, with their squared distances
+	std::vector<PointId> ids;
+	std::vector<float> distances;
+
+	// points of a dataset block handled together by every query of a
+	// chunk, sized to stay in the cache while they are reused
+	static const size_t TILE_BYTES = 256 << 10;
+
+public:
+	GroundTruth(): k(0) {}
+
+	// scans the dataset once, block by block, the queries are split
+	// between the query threads
+	void compute(const std::string& dataset, size_t dataset_size, const std::string& queries, size_t queries_size, size_t dimensions, size_t k, size_t num_threads);
+
+	size_t get_k() const {
+		return k;
+	}
+	size_t size() const {
+		return k == 0? 0: ids.size() / k;
+	}
+	const PointId* neighbors(size_t query) const {
+		return ids.data() + query * k;
+	}
+	const float* neighbor_distances(size_t query) const {
+		return distances.data() + query * k;
+	}
+
+	void save(const std::string& path) const;
+
+	void serialize(std::ofstream& out) const override;
+	void deserialize(std::ifstream& in) override;
+};
+
+};
+
+#endif // __GROUNDTRUTH_HPP__
@@ -2,6 +2,10 @@
 #include <iostream>
 #include <algorithm>
 #include <numeric>
+#include <atomic>
+#ifdef MULTITHREADED_ENABLED
+#include <thread>
+#endif
 
 
 #include "index.hpp"
@@ -12,15 +16,28 @@
 #include "data.hpp"
 #include "timer.hpp"
 #include "ktree.hpp"
+#include "kernels.hpp"
+
+#ifdef MULTITHREADED_ENABLED
+#include "threadpool.hpp"
+#endif
 
 
 namespace KTREE {
 
 Index::Index() {
 	ktree = new KTree();
+#ifdef MULTITHREADED_ENABLED
+	scan_pool = nullptr;
+	prefetcher = nullptr;
+#endif
 }
 
 Index::~Index() {
+#ifdef MULTITHREADED_ENABLED
+	delete scan_pool;
+	delete prefetcher;
+#endif
 	delete ktree;
 }
 
@@ -53,6 +70,9 @@ void Index::build() {
 	LOG("Building KTree");
 
 	ktree->index(config.dataset, config.dataset_size);
+	if (config.leaf_storage == PACKED) {
+		ktree->pack_leaves();
+	}
 	// ktree->print();
 
 
@@ -83,6 +103,16 @@ void Index::load() {
 
 	LOG("Leaf nodes: " << counter[0] << " Internal nodes: " << counter[1]);
 	LOG("Index loaded successfully");
+
+#ifdef MULTITHREADED_ENABLED
+	if (config.scan_threads > 1) {
+		scan_pool = new THREADS::ScanPool(config.scan_threads - 1);
+	}
+	// leaves viewed in the packed store only need a hint to the kernel
+	if (config.prefetch > 0 && ktree->get_buffer_pool() != nullptr) {
+		prefetcher = new THREADS::Prefetcher(config.prefetch);
+	}
+#endif
 	
 
 	in.close();
@@ -111,16 +141,108 @@ void Index::save() {
 }
 
 void Index::serialize(std::ofstream& out) const {
+	KTREE::serialize(MAGIC, out);
+	KTREE::serialize(FORMAT_VERSION, out);
 	KTREE::Config::get_instance()->serialize(out);
 	ktree->serialize(out);
 }
 
 void Index::deserialize(std::ifstream& in) {
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	KTREE::deserialize(magic, in);
+	KTREE::deserialize(version, in);
+	if (!in || magic != MAGIC) {
+		throw KTreeError("Not a ktree index file, or written before the format was versioned: rebuild the index");
+	}
+	if (version != FORMAT_VERSION) {
+		throw KTreeError("Index format version " + std::to_string(version) + " is not supported (expected " + std::to_string(FORMAT_VERSION) + "): rebuild the index");
+	}
 	KTREE::Config::get_instance()->deserialize(in);
 	ktree->deserialize(in);
 }
+
+// search counters shared by every query type
+template<typename Q>
+static void record_counters(QueryRecord& record, const Q& query, size_t dataset_size) {
+	record.distance_computation = query.get_distance_computation();
+	record.visit_count = query.get_visit_count();
+	record.leaf_count = query.get_leaf_count();
+	record.pruned_count = query.get_pruned_count();
+	record.pruning_ratio = query.pruning_ratio(dataset_size);
+#ifdef QUERY_STATS_ENABLED
+	record.stats = query.get_stats();
+	record.stats.distance_computations = record.distance_computation;
+	record.stats.leaves_visited = record.leaf_count;
+	record.stats.pruning_ratio = record.pruning_ratio;
+#endif
+}
+
+void Index::run_queries(const DataContainer& queries, std::vector<QueryRecord>& records) const {
+	const Config *config = KTREE::Config::get_instance();
+	records.resize(queries.size());
+	// each worker answers whole queries with its own Query,
+	// records are kept by query id so the output order is preserved
+	std::atomic<size_t> next_query(0);
+	auto worker = [&]() {
+		Timer t;
+		size_t i;
+		while ((i = next_query++) < queries.size()) {
+			t.reset();
+			t.start();
+			QueryRecord& record = records[i];
+			if (config->search_mode == RANGE) {
+				RangeQuery query(queries[i], config->radius);
+				ktree->search_range(query);
+				t.stop();
+
+				record_counters(record, query, config->dataset_size);
+				record.result_count = query.get_results().size();
+				// every point within the radius is returned
+				record.bound = query.get_squared_radius();
+				record.epsilon = 0.0f;
+				record.ids.clear();
+			}
+			else {
+				Query query(queries[i], config->k);
+#ifdef MULTITHREADED_ENABLED
+				query.set_scan_pool(scan_pool);
+				query.set_prefetcher(prefetcher);
+#endif
+
+				ktree->search(query);
+				t.stop();
+
+				record_counters(record, query, config->dataset_size);
+				record.result_count = query.get_results()->size();
+				record.bound = query.achieved_bound();
+				record.epsilon = query.achieved_epsilon();
+				record.ids.clear();
+				for (const Result& result: query.get_results()->sorted()) {
+					record.ids.push_back(result.id);
+				}
+			}
+			record.time = t.seconds();
+			STATS(record.stats.total_time = record.time);
+		}
+	};
+
+#ifdef MULTITHREADED_ENABLED
+	size_t num_threads = std::min<size_t>(config->query_threads, queries.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < num_threads; i++) {
+		workers.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto& w: workers) {
+		w.join();
+	}
+#else
+	worker();
+#endif
+}
+
 void Index::search() {
-	Timer t;
 	DataContainer* queries = nullptr;
 	const Config *config = KTREE::Config::get_instance();
 
@@ -136,19 +258,46 @@ void Index::search() {
 		LOG("FAILED TO LOAD QUERIES DATA")
 		throw KTreeError(e.what());
 	}
-	LOG("STARTING SEARCH:")
-	std::cout << "------------------" << std::endl;
-	std::cout << "Query ID, Query Time, Distance Computations, Visit Count" << std::endl;
-	for (size_t i = 0; i < queries->size(); i++) {
-		t.reset();
-		t.start();
-		Query query(queries->operator[](i));
 
-		ktree->search(query);
-		t.stop();
+	std::vector<QueryRecord> records(queries->size());
+	LOG("DISTANCE KERNEL: " << SIMD::isa_name(SIMD::detected_isa()))
+	LOG("STARTING SEARCH:")
+	run_queries(*queries, records);
 
-		std::cout << i << ", " << t.to_string() << ", " << query.get_distance_computation() << ", " << query.get_visit_count() << std::endl;
+	std::cout << "------------------" << std::endl;
+	std::cout << "Query ID, Query Time, Distance Computations, Visit Count, Leaves Visited, Nodes Pruned, Results, Pruning Ratio, Bound, Epsilon" << std::endl;
+	for (size_t i = 0; i < records.size(); i++) {
+		const QueryRecord& record = records[i];
+		std::cout << i << ", " << std::to_string(record.time) << " s, " << record.distance_computation << ", " << record.visit_count
+			<< ", " << record.leaf_count << ", " << record.pruned_count << ", " << record.result_count << ", " << record.pruning_ratio
+			<< ", " << record.bound << ", " << record.epsilon << std::endl;
+	}
+	if (!config->stats_path.empty()) {
+#ifdef QUERY_STATS_ENABLED
+		std::vector<QueryStats> stats;
+		for (const QueryRecord& record: records) {
+			stats.push_back(record.stats);
+		}
+		QueryStats::write(config->stats_path, stats);
+		LOG("QUERY STATISTICS WRITTEN TO: " << config->stats_path)
+#else
+		LOG("QUERY STATISTICS ARE NOT BUILT IN, IGNORING --stats")
+#endif
+	}
+	const BufferPool *buffer_pool = ktree->get_buffer_pool();
+	if (buffer_pool != nullptr) {
+		std::cout << "------------------" << std::endl;
+		std::cout << "Buffer Pool Hits, Misses, Evictions, Used Bytes" << std::endl;
+		std::cout << buffer_pool->get_hits() << ", " << buffer_pool->get_misses() << ", " << buffer_pool->get_evictions()
+			<< ", " << buffer_pool->get_used() << std::endl;
+	}
+#ifdef MULTITHREADED_ENABLED
+	if (prefetcher != nullptr) {
+		std::cout << "------------------" << std::endl;
+		std::cout << "Prefetch Issued, Completed, Cancelled" << std::endl;
+		std::cout << prefetcher->get_issued() << ", " << prefetcher->get_completed() << ", " << prefetcher->get_cancelled() << std::endl;
 	}
+#endif
 	delete queries;
 
 }
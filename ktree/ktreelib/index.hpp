@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <utility>
+#include <string>
+#include <cstdint>
 #include <Eigen/Dense>
 
 #include "config.hpp"
@@ -10,15 +12,46 @@
 #include "data.hpp"
 
 #include "serialization.hpp"
+#include "stats.hpp"
 
 
 namespace KTREE {
 
+// per query output line of Index::search
+struct QueryRecord {
+	// seconds
+	double time;
+	size_t distance_computation;
+	size_t visit_count;
+	size_t leaf_count;
+	size_t pruned_count;
+	size_t result_count;
+	float pruning_ratio;
+	float bound;
+	float epsilon;
+	// nearest neighbors found, closest first, empty for range queries
+	std::vector<PointId> ids;
+#ifdef QUERY_STATS_ENABLED
+	QueryStats stats;
+#endif
+};
+
 class Index: public Serializable {
 private:
 	KTree *ktree;
+#ifdef MULTITHREADED_ENABLED
+	// helpers scanning the leaves of a single query, shared by all query threads
+	THREADS::ScanPool *scan_pool;
+	// readers of the leaves next in line, one per leaf read ahead
+	THREADS::Prefetcher *prefetcher;
+#endif
 
 public:
+	// start of index.bin: "KTRE", then the version of the format,
+	// bumped whenever the layout of the index files changes
+	static constexpr uint32_t MAGIC = 0x4552544b;
+	static constexpr uint32_t FORMAT_VERSION = 2;
+
 	Index();
 	~Index();
 
@@ -26,6 +59,9 @@ public:
 	void save();
 	void load(); 
 	void search();
+
+	// answers every query on the query threads, records[i] is filled for query i
+	void run_queries(const DataContainer& queries, std::vector<QueryRecord>& records) const;
 	void serialize(std::ofstream& out) const override;
 	void deserialize(std::ifstream& in) override;
 };
@@ -0,0 +1,177 @@
+#include "io.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+
+namespace KTREE {
+
+BlockReader::BlockReader(const std::string& path, size_t dimensions, size_t num_points, size_t block_bytes, bool read_ahead):
+	dimensions(dimensions), position(0), first(0), read_ahead(read_ahead), ahead_count(0)
+#ifdef MULTITHREADED_ENABLED
+	, requested(false), ready(false), stop(false)
+#endif
+{
+	file.open(path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open the data file for reading");
+	}
+	file.seekg(0, std::ios::end);
+	size_t file_points = static_cast<size_t>(file.tellg()) / (dimensions * sizeof(float));
+	file.seekg(0, std::ios::beg);
+	if (num_points == 0) {
+		num_points = file_points;
+	}
+	else if (num_points > file_points) {
+		throw std::runtime_error("Invalid number of points in data file");
+	}
+	this->num_points = num_points;
+	block_points = std::max<size_t>(1, block_bytes / (dimensions * sizeof(float)));
+	// a single block leaves nothing to read while the caller works
+	this->read_ahead = read_ahead && num_points > block_points;
+	if (this->read_ahead) {
+#ifdef MULTITHREADED_ENABLED
+		reader = std::thread(&BlockReader::read_ahead_loop, this);
+#endif
+		start_read_ahead();
+	}
+}
+
+BlockReader::~BlockReader() {
+#ifdef MULTITHREADED_ENABLED
+	if (reader.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(ahead_mtx);
+			stop = true;
+		}
+		ahead_cv.notify_all();
+		reader.join();
+	}
+#endif
+}
+
+size_t BlockReader::read(std::vector<float>& points) {
+	size_t count = std::min(block_points, num_points - position);
+	points.resize(count * dimensions);
+	if (count == 0) {
+		return 0;
+	}
+	file.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(float));
+	if (static_cast<size_t>(file.gcount()) != points.size() * sizeof(float)) {
+		throw std::runtime_error("Could not read the data file");
+	}
+	position += count;
+	return count;
+}
+
+void BlockReader::read_next_block() {
+	try {
+		ahead_count = read(ahead);
+	} catch (...) {
+		ahead_error = std::current_exception();
+	}
+}
+
+#ifdef MULTITHREADED_ENABLED
+void BlockReader::read_ahead_loop() {
+	std::unique_lock<std::mutex> lock(ahead_mtx);
+	while (true) {
+		ahead_cv.wait(lock, [this] { return stop || requested; });
+		if (stop) {
+			break;
+		}
+		requested = false;
+		lock.unlock();
+		read_next_block();
+		lock.lock();
+		ready = true;
+		ahead_cv.notify_all();
+	}
+}
+#endif
+
+void BlockReader::start_read_ahead() {
+#ifdef MULTITHREADED_ENABLED
+	{
+		std::lock_guard<std::mutex> lock(ahead_mtx);
+		ready = false;
+		requested = true;
+	}
+	ahead_cv.notify_all();
+#else
+	read_next_block();
+#endif
+}
+
+void BlockReader::wait_read_ahead() {
+#ifdef MULTITHREADED_ENABLED
+	std::unique_lock<std::mutex> lock(ahead_mtx);
+	ahead_cv.wait(lock, [this] { return ready; });
+#endif
+	if (ahead_error) {
+		std::rethrow_exception(ahead_error);
+	}
+}
+
+size_t BlockReader::next(std::vector<float>& points) {
+	if (!read_ahead) {
+		first = position;
+		return read(points);
+	}
+	wait_read_ahead();
+	first = position - ahead_count;
+	points.swap(ahead);
+	size_t count = ahead_count;
+	if (position < num_points) {
+		start_read_ahead();
+	}
+	else {
+		// every point was read, the reader thread is left idle
+		ahead.clear();
+		ahead_count = 0;
+	}
+	return count;
+}
+
+BufferedWriter::BufferedWriter(const std::string& path, size_t buffer_bytes): buffer(buffer_bytes), used(0) {
+	file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open the file for writing");
+	}
+}
+
+BufferedWriter::~BufferedWriter() {
+	if (file.is_open()) {
+		file.write(buffer.data(), used);
+		file.close();
+	}
+}
+
+void BufferedWriter::write(const void *data, size_t bytes) {
+	if (used + bytes > buffer.size()) {
+		flush();
+		// larger than the buffer, written as is
+		if (bytes >= buffer.size()) {
+			file.write(static_cast<const char*>(data), bytes);
+			return;
+		}
+	}
+	std::memcpy(buffer.data() + used, data, bytes);
+	used += bytes;
+}
+
+void BufferedWriter::flush() {
+	file.write(buffer.data(), used);
+	used = 0;
+	if (!file.good()) {
+		throw std::runtime_error("Could not write to the file");
+	}
+}
+
+void BufferedWriter::close() {
+	flush();
+	file.close();
+}
+
+};
@@ -0,0 +1,99 @@
+#ifndef __IO_HPP__
+#define __IO_HPP__
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <exception>
+
+#ifdef MULTITHREADED_ENABLED
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace KTREE {
+
+// reads the points of a data file front to back in large blocks of
+// whole points, each block is a single sequential read. with read ahead,
+// the next block is read in the background while the caller works on the
+// current one (double buffering) by a thread the reader keeps until it is
+// destroyed. a file that fits in a single block is read without it
+class BlockReader {
+private:
+	std::ifstream file;
+	size_t dimensions;
+	size_t block_points;
+	size_t num_points;
+	// id of the next point to read from the file
+	size_t position;
+	// id of the first point of the last block returned
+	size_t first;
+
+	bool read_ahead;
+	std::vector<float> ahead;
+	size_t ahead_count;
+	std::exception_ptr ahead_error;
+#ifdef MULTITHREADED_ENABLED
+	// the read ahead thread waits for a request, reads the next block
+	// into ahead and marks it ready
+	std::thread reader;
+	std::mutex ahead_mtx;
+	std::condition_variable ahead_cv;
+	bool requested;
+	bool ready;
+	bool stop;
+
+	void read_ahead_loop();
+#endif
+
+	size_t read(std::vector<float>& points);
+	void read_next_block();
+	void start_read_ahead();
+	void wait_read_ahead();
+
+public:
+	static const size_t BLOCK_BYTES = 64 << 20;
+
+	// num_points = 0 reads the whole file
+	BlockReader(const std::string& path, size_t dimensions, size_t num_points = 0, size_t block_bytes = BLOCK_BYTES, bool read_ahead = false);
+	BlockReader(const BlockReader&) = delete;
+	~BlockReader();
+
+	// the next block into points, returns its number of points,
+	// 0 once every point was read
+	size_t next(std::vector<float>& points);
+
+	// id of the first point of the last block returned by next
+	size_t block_start() const {
+		return first;
+	}
+
+	size_t size() const {
+		return num_points;
+	}
+};
+
+// writes a file through a large buffer, each flush is a single write
+class BufferedWriter {
+private:
+	std::ofstream file;
+	std::vector<char> buffer;
+	size_t used;
+
+public:
+	static const size_t BUFFER_BYTES = 4 << 20;
+
+	BufferedWriter(const std::string& path, size_t buffer_bytes = BUFFER_BYTES);
+	BufferedWriter(const BufferedWriter&) = delete;
+	// writes what is left in the buffer, errors are only reported by close
+	~BufferedWriter();
+
+	void write(const void *data, size_t bytes);
+	void flush();
+	void close();
+};
+
+};
+
+#endif // __IO_HPP__
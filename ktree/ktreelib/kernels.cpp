@@ -0,0 +1,701 @@
+#include <algorithm>
+#include <cmath>
+
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace SIMD {
+
+typedef float (*L2Kernel)(const float *, const float *, size_t, float);
+typedef void (*L2GroupKernel)(const float *, const float *, size_t, float *, float);
+typedef float (*Sq8Kernel)(const float *, const float *, const uint8_t *, size_t, float);
+typedef float (*AdcKernel)(const float *, const uint8_t *, size_t, float);
+typedef float (*EnvelopeKernel)(const float *, const float *, const float *, const float *, size_t);
+typedef float (*BoxKernel)(const float *, const float *, const float *, size_t);
+typedef float (*RffKernel)(const float *, const size_t *, size_t, const float *, const float *, const float *, size_t);
+
+static float squared_l2_scalar(const float *a, const float *b, size_t n, float threshold) {
+	float sum = 0.0f;
+	size_t i = 0;
+	while (i < n) {
+		size_t end = std::min(i + ABANDON_BLOCK, n);
+		for (; i < end; i++) {
+			float diff = a[i] - b[i];
+			sum += diff * diff;
+		}
+		if (sum >= threshold) {
+			break;
+		}
+	}
+	return sum;
+}
+
+static void squared_l2_group_scalar(const float *q, const float *group, size_t n, float *distances, float threshold) {
+	std::fill(distances, distances + POINT_GROUP, 0.0f);
+	size_t i = 0;
+	while (i < n) {
+		size_t end = std::min(i + ABANDON_BLOCK, n);
+		for (; i < end; i++) {
+			const float *values = group + i * POINT_GROUP;
+			for (size_t p = 0; p < POINT_GROUP; p++) {
+				float diff = values[p] - q[i];
+				distances[p] += diff * diff;
+			}
+		}
+		if (*std::min_element(distances, distances + POINT_GROUP) >= threshold) {
+			break;
+		}
+	}
+}
+
+static float sq8_l2_scalar(const float *shifted_q, const float *scales, const uint8_t *codes, size_t n, float threshold) {
+	float sum = 0.0f;
+	size_t i = 0;
+	while (i < n) {
+		size_t end = std::min(i + ABANDON_BLOCK, n);
+		for (; i < end; i++) {
+			float diff = shifted_q[i] - scales[i] * codes[i];
+			sum += diff * diff;
+		}
+		if (sum >= threshold) {
+			break;
+		}
+	}
+	return sum;
+}
+
+static float adc_l2_scalar(const float *table, const uint8_t *codes, size_t m, float threshold) {
+	float sum = 0.0f;
+	size_t j = 0;
+	while (j < m) {
+		size_t end = std::min(j + ABANDON_BLOCK, m);
+		for (; j < end; j++) {
+			sum += table[j * ADC_TABLE_WIDTH + codes[j]];
+		}
+		if (sum >= threshold) {
+			break;
+		}
+	}
+	return sum;
+}
+
+// cos(t) = cos(2 pi y), y is reduced to [-1/2, 1/2] turns, folded to
+// [0, 1/4] and evaluated with the taylor series up to the 12th power
+static const float TWO_PI = 6.28318530717958647692f;
+static const float INV_TWO_PI = 0.15915494309189533577f;
+static const float COS_C1 = -1.0f / 2.0f;
+static const float COS_C2 = 1.0f / 24.0f;
+static const float COS_C3 = -1.0f / 720.0f;
+static const float COS_C4 = 1.0f / 40320.0f;
+static const float COS_C5 = -1.0f / 3628800.0f;
+static const float COS_C6 = 1.0f / 479001600.0f;
+
+static inline float fast_cos(float t) {
+	float y = t * INV_TWO_PI;
+	y = std::fabs(y - std::nearbyint(y));
+	float sign = 1.0f;
+	if (y > 0.25f) {
+		y = 0.5f - y;
+		sign = -1.0f;
+	}
+	float theta = y * TWO_PI;
+	float z = theta * theta;
+	float p = COS_C6;
+	p = p * z + COS_C5;
+	p = p * z + COS_C4;
+	p = p * z + COS_C3;
+	p = p * z + COS_C2;
+	p = p * z + COS_C1;
+	p = p * z + 1.0f;
+	return sign * p;
+}
+
+static float rff_project_scalar(
+	const float *x, const size_t *dimensions, size_t n_dimensions,
+	const float *weights, const float *bias, const float *coefficients, size_t n_features
+) {
+	float sum = 0.0f;
+	for (size_t j = 0; j < n_features; j++) {
+		float t = bias[j];
+		for (size_t i = 0; i < n_dimensions; i++) {
+			t += weights[i * n_features + j] * x[dimensions[i]];
+		}
+		sum += coefficients[j] * fast_cos(t);
+	}
+	return sum;
+}
+
+static float envelope_bound_scalar(const float *q, const float *mins, const float *maxs, const float *lengths, size_t n) {
+	float sum = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		float gap = std::max(std::max(mins[i] - q[i], q[i] - maxs[i]), 0.0f);
+		sum += lengths[i] * gap * gap;
+	}
+	return sum;
+}
+
+static float box_bound_scalar(const float *q, const float *mins, const float *maxs, size_t n) {
+	float sum = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		float gap = std::max(std::max(mins[i] - q[i], q[i] - maxs[i]), 0.0f);
+		sum += gap * gap;
+	}
+	return sum;
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(__m256 v) {
+	__m128 lo = _mm256_castps256_ps128(v);
+	__m128 hi = _mm256_extractf128_ps(v, 1);
+	lo = _mm_add_ps(lo, hi);
+	lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+	lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+	return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma")))
+static float squared_l2_avx2(const float *a, const float *b, size_t n, float threshold) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m256 acc2 = _mm256_setzero_ps();
+	__m256 acc3 = _mm256_setzero_ps();
+	size_t i = 0;
+	// one block of 32 dimensions per iteration, then the abandoning check
+	for (; i + ABANDON_BLOCK <= n; i += ABANDON_BLOCK) {
+		__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+		__m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+		__m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+		acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+		acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+		acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+		acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+		float partial = hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+		if (partial >= threshold) {
+			return partial;
+		}
+	}
+	for (; i + 8 <= n; i += 8) {
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		acc0 = _mm256_fmadd_ps(d, d, acc0);
+	}
+	float sum = hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+	for (; i < n; i++) {
+		float diff = a[i] - b[i];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+// codes are widened to 32 bit integers then to floats, 8 at a time
+__attribute__((target("avx2,fma")))
+static float sq8_l2_avx2(const float *shifted_q, const float *scales, const uint8_t *codes, size_t n, float threshold) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + ABANDON_BLOCK <= n; i += ABANDON_BLOCK) {
+		for (size_t j = i; j < i + ABANDON_BLOCK; j += 16) {
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + j));
+			__m256 c0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+			__m256 c1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+			__m256 d0 = _mm256_fnmadd_ps(_mm256_loadu_ps(scales + j), c0, _mm256_loadu_ps(shifted_q + j));
+			__m256 d1 = _mm256_fnmadd_ps(_mm256_loadu_ps(scales + j + 8), c1, _mm256_loadu_ps(shifted_q + j + 8));
+			acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+			acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+		}
+		float partial = hsum_avx2(_mm256_add_ps(acc0, acc1));
+		if (partial >= threshold) {
+			return partial;
+		}
+	}
+	float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+	for (; i < n; i++) {
+		float diff = shifted_q[i] - scales[i] * codes[i];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+// 8 subspaces per gather, lane l reads entry codes[j + l] of row j + l
+__attribute__((target("avx2,fma")))
+static float adc_l2_avx2(const float *table, const uint8_t *codes, size_t m, float threshold) {
+	const __m256i rows = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(ADC_TABLE_WIDTH));
+	__m256 acc = _mm256_setzero_ps();
+	size_t j = 0;
+	while (j + 8 <= m) {
+		size_t end = std::min(j + ABANDON_BLOCK, m);
+		for (; j + 8 <= end; j += 8) {
+			__m256i entries = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(codes + j)));
+			acc = _mm256_add_ps(acc, _mm256_i32gather_ps(table + j * ADC_TABLE_WIDTH, _mm256_add_epi32(rows, entries), 4));
+		}
+		float partial = hsum_avx2(acc);
+		if (partial >= threshold) {
+			return partial;
+		}
+	}
+	float sum = hsum_avx2(acc);
+	for (; j < m; j++) {
+		sum += table[j * ADC_TABLE_WIDTH + codes[j]];
+	}
+	return sum;
+}
+
+// one lane per point, the group is read one dimension at a time
+__attribute__((target("avx2,fma")))
+static void squared_l2_group_avx2(const float *q, const float *group, size_t n, float *distances, float threshold) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	const __m256 limit = _mm256_set1_ps(threshold);
+	size_t i = 0;
+	while (i < n) {
+		size_t end = std::min(i + ABANDON_BLOCK, n);
+		for (; i < end; i++) {
+			const float *values = group + i * POINT_GROUP;
+			__m256 qi = _mm256_set1_ps(q[i]);
+			__m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(values), qi);
+			__m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(values + 8), qi);
+			acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+			acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+		}
+		__m256 below = _mm256_cmp_ps(_mm256_min_ps(acc0, acc1), limit, _CMP_LT_OQ);
+		if (_mm256_movemask_ps(below) == 0) {
+			break;
+		}
+	}
+	_mm256_storeu_ps(distances, acc0);
+	_mm256_storeu_ps(distances + 8, acc1);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 fast_cos_avx2(__m256 t) {
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 y = _mm256_mul_ps(t, _mm256_set1_ps(INV_TWO_PI));
+	y = _mm256_sub_ps(y, _mm256_round_ps(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+	y = _mm256_and_ps(y, abs_mask);
+	__m256 flip = _mm256_cmp_ps(y, _mm256_set1_ps(0.25f), _CMP_GT_OQ);
+	y = _mm256_blendv_ps(y, _mm256_sub_ps(_mm256_set1_ps(0.5f), y), flip);
+	__m256 theta = _mm256_mul_ps(y, _mm256_set1_ps(TWO_PI));
+	__m256 z = _mm256_mul_ps(theta, theta);
+	__m256 p = _mm256_set1_ps(COS_C6);
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(COS_C5));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(COS_C4));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(COS_C3));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(COS_C2));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(COS_C1));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.0f));
+	// negate the folded lanes
+	return _mm256_xor_ps(p, _mm256_and_ps(flip, _mm256_set1_ps(-0.0f)));
+}
+
+__attribute__((target("avx2,fma")))
+static float rff_project_avx2(
+	const float *x, const size_t *dimensions, size_t n_dimensions,
+	const float *weights, const float *bias, const float *coefficients, size_t n_features
+) {
+	__m256 sum = _mm256_setzero_ps();
+	size_t j = 0;
+	for (; j + 8 <= n_features; j += 8) {
+		__m256 t = _mm256_loadu_ps(bias + j);
+		for (size_t i = 0; i < n_dimensions; i++) {
+			t = _mm256_fmadd_ps(_mm256_set1_ps(x[dimensions[i]]), _mm256_loadu_ps(weights + i * n_features + j), t);
+		}
+		sum = _mm256_fmadd_ps(_mm256_loadu_ps(coefficients + j), fast_cos_avx2(t), sum);
+	}
+	float result = hsum_avx2(sum);
+	for (; j < n_features; j++) {
+		float t = bias[j];
+		for (size_t i = 0; i < n_dimensions; i++) {
+			t += weights[i * n_features + j] * x[dimensions[i]];
+		}
+		result += coefficients[j] * fast_cos(t);
+	}
+	return result;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 fast_cos_avx512(__m512 t) {
+	__m512 y = _mm512_mul_ps(t, _mm512_set1_ps(INV_TWO_PI));
+	y = _mm512_sub_ps(y, _mm512_roundscale_ps(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+	y = _mm512_abs_ps(y);
+	__mmask16 flip = _mm512_cmp_ps_mask(y, _mm512_set1_ps(0.25f), _CMP_GT_OQ);
+	y = _mm512_mask_sub_ps(y, flip, _mm512_set1_ps(0.5f), y);
+	__m512 theta = _mm512_mul_ps(y, _mm512_set1_ps(TWO_PI));
+	__m512 z = _mm512_mul_ps(theta, theta);
+	__m512 p = _mm512_set1_ps(COS_C6);
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(COS_C5));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(COS_C4));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(COS_C3));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(COS_C2));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(COS_C1));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(1.0f));
+	return _mm512_mask_sub_ps(p, flip, _mm512_setzero_ps(), p);
+}
+
+__attribute__((target("avx512f")))
+static float rff_project_avx512(
+	const float *x, const size_t *dimensions, size_t n_dimensions,
+	const float *weights, const float *bias, const float *coefficients, size_t n_features
+) {
+	__m512 sum = _mm512_setzero_ps();
+	for (size_t j = 0; j < n_features; j += 16) {
+		__mmask16 mask = n_features - j >= 16? 0xffff: static_cast<__mmask16>((1u << (n_features - j)) - 1);
+		__m512 t = _mm512_maskz_loadu_ps(mask, bias + j);
+		for (size_t i = 0; i < n_dimensions; i++) {
+			t = _mm512_fmadd_ps(_mm512_set1_ps(x[dimensions[i]]), _mm512_maskz_loadu_ps(mask, weights + i * n_features + j), t);
+		}
+		// masked out lanes have a zero coefficient
+		sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, coefficients + j), fast_cos_avx512(t), sum);
+	}
+	return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float envelope_bound_avx2(const float *q, const float *mins, const float *maxs, const float *lengths, size_t n) {
+	__m256 sum = _mm256_setzero_ps();
+	__m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 qv = _mm256_loadu_ps(q + i);
+		__m256 below = _mm256_sub_ps(_mm256_loadu_ps(mins + i), qv);
+		__m256 above = _mm256_sub_ps(qv, _mm256_loadu_ps(maxs + i));
+		__m256 gap = _mm256_max_ps(_mm256_max_ps(below, above), zero);
+		sum = _mm256_fmadd_ps(_mm256_mul_ps(gap, gap), _mm256_loadu_ps(lengths + i), sum);
+	}
+	float result = hsum_avx2(sum);
+	for (; i < n; i++) {
+		float gap = std::max(std::max(mins[i] - q[i], q[i] - maxs[i]), 0.0f);
+		result += lengths[i] * gap * gap;
+	}
+	return result;
+}
+
+__attribute__((target("avx2,fma")))
+static float box_bound_avx2(const float *q, const float *mins, const float *maxs, size_t n) {
+	__m256 sum = _mm256_setzero_ps();
+	__m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 qv = _mm256_loadu_ps(q + i);
+		__m256 below = _mm256_sub_ps(_mm256_loadu_ps(mins + i), qv);
+		__m256 above = _mm256_sub_ps(qv, _mm256_loadu_ps(maxs + i));
+		__m256 gap = _mm256_max_ps(_mm256_max_ps(below, above), zero);
+		sum = _mm256_fmadd_ps(gap, gap, sum);
+	}
+	float result = hsum_avx2(sum);
+	for (; i < n; i++) {
+		float gap = std::max(std::max(mins[i] - q[i], q[i] - maxs[i]), 0.0f);
+		result += gap * gap;
+	}
+	return result;
+}
+
+__attribute__((target("avx512f")))
+static float envelope_bound_avx512(const float *q, const float *mins, const float *maxs, const float *lengths, size_t n) {
+	__m512 sum = _mm512_setzero_ps();
+	__m512 zero = _mm512_setzero_ps();
+	for (size_t i = 0; i < n; i += 16) {
+		__mmask16 mask = n - i >= 16? 0xffff: static_cast<__mmask16>((1u << (n - i)) - 1);
+		__m512 qv = _mm512_maskz_loadu_ps(mask, q + i);
+		__m512 below = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, mins + i), qv);
+		__m512 above = _mm512_sub_ps(qv, _mm512_maskz_loadu_ps(mask, maxs + i));
+		__m512 gap = _mm512_max_ps(_mm512_max_ps(below, above), zero);
+		// masked out lanes have a zero length
+		sum = _mm512_fmadd_ps(_mm512_mul_ps(gap, gap), _mm512_maskz_loadu_ps(mask, lengths + i), sum);
+	}
+	return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+static float box_bound_avx512(const float *q, const float *mins, const float *maxs, size_t n) {
+	__m512 sum = _mm512_setzero_ps();
+	__m512 zero = _mm512_setzero_ps();
+	for (size_t i = 0; i < n; i += 16) {
+		// masked out lanes load zeros and have no gap
+		__mmask16 mask = n - i >= 16? 0xffff: static_cast<__mmask16>((1u << (n - i)) - 1);
+		__m512 qv = _mm512_maskz_loadu_ps(mask, q + i);
+		__m512 below = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, mins + i), qv);
+		__m512 above = _mm512_sub_ps(qv, _mm512_maskz_loadu_ps(mask, maxs + i));
+		__m512 gap = _mm512_max_ps(_mm512_max_ps(below, above), zero);
+		sum = _mm512_fmadd_ps(gap, gap, sum);
+	}
+	return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+static float squared_l2_avx512(const float *a, const float *b, size_t n, float threshold) {
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	size_t i = 0;
+	for (; i + ABANDON_BLOCK <= n; i += ABANDON_BLOCK) {
+		__m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+		__m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+		acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+		acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+		float partial = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+		if (partial >= threshold) {
+			return partial;
+		}
+	}
+	// remaining dimensions with a masked load
+	if (i < n) {
+		__mmask16 mask = static_cast<__mmask16>((1u << std::min<size_t>(n - i, 16)) - 1);
+		__m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+		acc0 = _mm512_fmadd_ps(d, d, acc0);
+		i += 16;
+		if (i < n) {
+			mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+			d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+			acc1 = _mm512_fmadd_ps(d, d, acc1);
+		}
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static float sq8_l2_avx512(const float *shifted_q, const float *scales, const uint8_t *codes, size_t n, float threshold) {
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	size_t i = 0;
+	for (; i + ABANDON_BLOCK <= n; i += ABANDON_BLOCK) {
+		__m512 c0 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + i))));
+		__m512 c1 = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + i + 16))));
+		__m512 d0 = _mm512_fnmadd_ps(_mm512_loadu_ps(scales + i), c0, _mm512_loadu_ps(shifted_q + i));
+		__m512 d1 = _mm512_fnmadd_ps(_mm512_loadu_ps(scales + i + 16), c1, _mm512_loadu_ps(shifted_q + i + 16));
+		acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+		acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+		float partial = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+		if (partial >= threshold) {
+			return partial;
+		}
+	}
+	float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+	for (; i < n; i++) {
+		float diff = shifted_q[i] - scales[i] * codes[i];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static float adc_l2_avx512(const float *table, const uint8_t *codes, size_t m, float threshold) {
+	const __m512i rows = _mm512_mullo_epi32(
+		_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+		_mm512_set1_epi32(ADC_TABLE_WIDTH)
+	);
+	__m512 acc = _mm512_setzero_ps();
+	size_t j = 0;
+	while (j + 16 <= m) {
+		size_t end = std::min(j + ABANDON_BLOCK, m);
+		for (; j + 16 <= end; j += 16) {
+			__m512i entries = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + j)));
+			acc = _mm512_add_ps(acc, _mm512_i32gather_ps(_mm512_add_epi32(rows, entries), table + j * ADC_TABLE_WIDTH, 4));
+		}
+		float partial = _mm512_reduce_add_ps(acc);
+		if (partial >= threshold) {
+			return partial;
+		}
+	}
+	float sum = _mm512_reduce_add_ps(acc);
+	for (; j < m; j++) {
+		sum += table[j * ADC_TABLE_WIDTH + codes[j]];
+	}
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static void squared_l2_group_avx512(const float *q, const float *group, size_t n, float *distances, float threshold) {
+	__m512 acc = _mm512_setzero_ps();
+	const __m512 limit = _mm512_set1_ps(threshold);
+	size_t i = 0;
+	while (i < n) {
+		size_t end = std::min(i + ABANDON_BLOCK, n);
+		for (; i < end; i++) {
+			__m512 d = _mm512_sub_ps(_mm512_loadu_ps(group + i * POINT_GROUP), _mm512_set1_ps(q[i]));
+			acc = _mm512_fmadd_ps(d, d, acc);
+		}
+		if (_mm512_cmp_ps_mask(acc, limit, _CMP_LT_OQ) == 0) {
+			break;
+		}
+	}
+	_mm512_storeu_ps(distances, acc);
+}
+
+#endif
+
+static ISA select_isa() {
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return ISA::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return ISA::AVX2;
+	}
+#endif
+	return ISA::SCALAR;
+}
+
+static L2Kernel select_l2_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return squared_l2_avx512;
+		case ISA::AVX2:
+			return squared_l2_avx2;
+#endif
+		default:
+			return squared_l2_scalar;
+	}
+}
+
+static L2GroupKernel select_l2_group_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return squared_l2_group_avx512;
+		case ISA::AVX2:
+			return squared_l2_group_avx2;
+#endif
+		default:
+			return squared_l2_group_scalar;
+	}
+}
+
+static Sq8Kernel select_sq8_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return sq8_l2_avx512;
+		case ISA::AVX2:
+			return sq8_l2_avx2;
+#endif
+		default:
+			return sq8_l2_scalar;
+	}
+}
+
+static AdcKernel select_adc_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return adc_l2_avx512;
+		case ISA::AVX2:
+			return adc_l2_avx2;
+#endif
+		default:
+			return adc_l2_scalar;
+	}
+}
+
+static RffKernel select_rff_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return rff_project_avx512;
+		case ISA::AVX2:
+			return rff_project_avx2;
+#endif
+		default:
+			return rff_project_scalar;
+	}
+}
+
+static EnvelopeKernel select_envelope_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return envelope_bound_avx512;
+		case ISA::AVX2:
+			return envelope_bound_avx2;
+#endif
+		default:
+			return envelope_bound_scalar;
+	}
+}
+
+static BoxKernel select_box_kernel(ISA isa) {
+	switch (isa) {
+#ifdef SIMD_X86
+		case ISA::AVX512:
+			return box_bound_avx512;
+		case ISA::AVX2:
+			return box_bound_avx2;
+#endif
+		default:
+			return box_bound_scalar;
+	}
+}
+
+static const ISA isa = select_isa();
+static const L2Kernel l2_kernel = select_l2_kernel(isa);
+static const L2GroupKernel l2_group_kernel = select_l2_group_kernel(isa);
+static const Sq8Kernel sq8_kernel = select_sq8_kernel(isa);
+static const AdcKernel adc_kernel = select_adc_kernel(isa);
+static const RffKernel rff_kernel = select_rff_kernel(isa);
+static const EnvelopeKernel envelope_kernel = select_envelope_kernel(isa);
+static const BoxKernel box_kernel = select_box_kernel(isa);
+
+ISA detected_isa() {
+	return isa;
+}
+
+const char *isa_name(ISA isa) {
+	switch (isa) {
+		case ISA::AVX512:
+			return "avx512";
+		case ISA::AVX2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+float squared_l2(const float *a, const float *b, size_t n, float threshold) {
+	return l2_kernel(a, b, n, threshold);
+}
+
+void squared_l2_group(const float *q, const float *group, size_t n, float *distances, float threshold) {
+	l2_group_kernel(q, group, n, distances, threshold);
+}
+
+float sq8_l2(const float *shifted_q, const float *scales, const uint8_t *codes, size_t n, float threshold) {
+	return sq8_kernel(shifted_q, scales, codes, n, threshold);
+}
+
+float adc_l2(const float *table, const uint8_t *codes, size_t m, float threshold) {
+	return adc_kernel(table, codes, m, threshold);
+}
+
+float envelope_bound(
+	const float *query_means,
+	const float *mins,
+	const float *maxs,
+	const float *lengths,
+	size_t n
+) {
+	return envelope_kernel(query_means, mins, maxs, lengths, n);
+}
+
+float box_bound(const float *q, const float *mins, const float *maxs, size_t n) {
+	return box_kernel(q, mins, maxs, n);
+}
+
+float rff_project(
+	const float *x,
+	const size_t *dimensions,
+	size_t n_dimensions,
+	const float *weights,
+	const float *bias,
+	const float *coefficients,
+	size_t n_features
+) {
+	return rff_kernel(x, dimensions, n_dimensions, weights, bias, coefficients, n_features);
+}
+
+};
@@ -0,0 +1,114 @@
+#ifndef __KERNELS_HPP__
+#define __KERNELS_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace SIMD {
+
+enum class ISA {
+	SCALAR,
+	AVX2,
+	AVX512
+};
+
+// instruction set picked at startup from the cpu features
+ISA detected_isa();
+const char *isa_name(ISA isa);
+
+// number of dimensions summed between two early abandoning checks
+const size_t ABANDON_BLOCK = 32;
+
+// squared euclidean distance between a and b,
+// once a partial sum reaches threshold the computation stops
+// and the partial sum (>= threshold) is returned
+float squared_l2(
+	const float *a,
+	const float *b,
+	size_t n,
+	float threshold = std::numeric_limits<float>::max()
+);
+
+// number of points stored together, dimension by dimension,
+// in the grouped leaf layout
+const size_t POINT_GROUP = 16;
+
+// squared euclidean distances between q and the POINT_GROUP points of
+// a group laid out as group[i * POINT_GROUP + p] for dimension i of point p.
+// once every partial sum reaches threshold the computation stops
+// and the partial sums (>= threshold) are written
+void squared_l2_group(
+	const float *q,
+	const float *group,
+	size_t n,
+	float *distances,
+	float threshold = std::numeric_limits<float>::max()
+);
+
+// squared euclidean distance between a query and a vector stored as 8 bit
+// codes with per dimension scales: sum_i (shifted_q[i] - scales[i] * codes[i])^2,
+// where shifted_q is the query minus the per dimension minimums. stops early
+// once a partial sum reaches threshold, like squared_l2
+float sq8_l2(
+	const float *shifted_q,
+	const float *scales,
+	const uint8_t *codes,
+	size_t n,
+	float threshold = std::numeric_limits<float>::max()
+);
+
+// number of centroids of each subspace of a product quantizer,
+// one row of the distance table per subspace
+const size_t ADC_TABLE_WIDTH = 256;
+
+// asymmetric distance between a query and a vector stored as one 8 bit
+// code per subspace: sum_j table[j * ADC_TABLE_WIDTH + codes[j]], where
+// row j holds the squared distances between the query and the centroids of
+// subspace j. stops early once a partial sum reaches threshold, like squared_l2
+float adc_l2(
+	const float *table,
+	const uint8_t *codes,
+	size_t m,
+	float threshold = std::numeric_limits<float>::max()
+);
+
+// squared euclidean lower bound between a query and an envelope of
+// segment means: sum_i lengths[i] * gap_i^2, where gap_i is the distance
+// from query_means[i] to [mins[i], maxs[i]], inputs are structure of arrays
+float envelope_bound(
+	const float *query_means,
+	const float *mins,
+	const float *maxs,
+	const float *lengths,
+	size_t n
+);
+
+// squared euclidean distance between q and the box [mins[i], maxs[i]]
+float box_bound(
+	const float *q,
+	const float *mins,
+	const float *maxs,
+	size_t n
+);
+
+// largest absolute error of the cosine approximation used by
+// rff_project, for arguments up to 100 radians
+const float COS_MAX_ERROR = 1e-5f;
+
+// fused random fourier features projection of x:
+// sum_j coefficients[j] * cos(bias[j] + sum_i weights[i * n_features + j] * x[dimensions[i]])
+// the selected dimensions are gathered straight from x, nothing is allocated
+float rff_project(
+	const float *x,
+	const size_t *dimensions,
+	size_t n_dimensions,
+	const float *weights,
+	const float *bias,
+	const float *coefficients,
+	size_t n_features
+);
+
+};
+
+#endif // __KERNELS_HPP__
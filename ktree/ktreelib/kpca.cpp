@@ -1,7 +1,9 @@
 #include "kpca.hpp"
+#include "kernels.hpp"
 
 
 #include <iostream>
+#include <algorithm>
 
 namespace PCA {
 
@@ -12,16 +14,7 @@ RandomFourierFeatures::RandomFourierFeatures(int n_features, float gamma) : n_fe
 	uniform_dist_ = std::uniform_real_distribution<float>(0.0, 2 * M_PI);
 }
 
-void RandomFourierFeatures::transform(
-	const Eigen::MatrixXf &data,
-	Eigen::MatrixXf &Z,
-	Eigen::MatrixXf &W,
-	Eigen::MatrixXf &b
-) {
-	int n_samples = data.rows();
-	int n_original_features = data.cols();
-
-	// initialize random weights and bias
+void RandomFourierFeatures::sample(int n_original_features, Eigen::MatrixXf &W, Eigen::MatrixXf &b) {
 	W = Eigen::MatrixXf(n_original_features, n_features);
 	b = Eigen::MatrixXf(1, n_features);
 
@@ -36,57 +29,165 @@ void RandomFourierFeatures::transform(
 	for (int i = 0; i < n_features; i++) {
 		b(0, i) = uniform_dist_(gen_);
 	}
+}
 
-	// compute the random features matrix Z
-	Z = Eigen::MatrixXf(n_samples, n_features);
+void top_eigenvector(const Eigen::MatrixXd &matrix, Eigen::VectorXd &eigenvector) {
+	const size_t max_iterations = 1000;
+	const double tolerance = 1e-9;
 
-	for (int i = 0; i < n_samples; i++) {
-		Eigen::VectorXf x = data.row(i);
-		for (int j = 0; j < n_features; j++) {
-			Z(i, j) = std::sqrt(2.0f / n_features) * std::cos(W.col(j).transpose() * x + b(0, j));
+	// a random start is almost surely not orthogonal to the eigenvector
+	std::mt19937 gen(matrix.rows());
+	std::normal_distribution<double> normal(0.0, 1.0);
+	eigenvector = Eigen::VectorXd(matrix.rows());
+	for (int i = 0; i < eigenvector.size(); i++) {
+		eigenvector(i) = normal(gen);
+	}
+	eigenvector.normalize();
+
+	for (size_t iteration = 0; iteration < max_iterations; iteration++) {
+		Eigen::VectorXd next = matrix * eigenvector;
+		double norm = next.norm();
+		if (norm == 0.0) {
+			// every vector is an eigenvector of the zero matrix
+			return;
 		}
+		next /= norm;
+		double change = (next - eigenvector).squaredNorm();
+		eigenvector = next;
+		if (change < tolerance) {
+			return;
+		}
+	}
+
+	// the two largest eigenvalues are too close for the iteration,
+	// eigenvalues are sorted in increasing order
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(matrix);
+	eigenvector = solver.eigenvectors().rightCols(1);
+}
+
+CovarianceFit::CovarianceFit(const Eigen::MatrixXf &W, const Eigen::MatrixXf &b):
+	W(W), b(b), covariance(Eigen::MatrixXd::Zero(W.cols(), W.cols())) {}
+
+void CovarianceFit::add(const Eigen::Ref<const Eigen::MatrixXf> &rows) {
+	float scale = std::sqrt(2.0f / W.cols());
+	Eigen::MatrixXf Z = (((rows * W).rowwise() + b.row(0)).array().cos() * scale).matrix();
+	covariance.selfadjointView<Eigen::Lower>().rankUpdate(Z.transpose().cast<double>());
+}
+
+void CovarianceFit::merge(const CovarianceFit &other) {
+	covariance += other.covariance;
+}
+
+void CovarianceFit::component(Eigen::MatrixXf &components) const {
+	// only the lower triangle is accumulated
+	Eigen::MatrixXd full = covariance.selfadjointView<Eigen::Lower>();
+	Eigen::VectorXd component;
+	top_eigenvector(full, component);
+	components = component.transpose().cast<float>();
+}
+
+HistogramMedian::HistogramMedian(float bound): low(-bound), high(bound), counts(BINS, 0), below(0), total(0), rounds(0) {
+	if (!(high > low)) {
+		high = low + 1.0f;
 	}
 }
 
-void performPCA(
-	const Eigen::MatrixXf &transformed_data,
-	Eigen::MatrixXf &components,
-	Eigen::MatrixXf &projected_data,
-	int n_components
-) {//BDCSVD here not Jacobi
-	Eigen::JacobiSVD<Eigen::MatrixXf> svd(transformed_data, Eigen::ComputeThinU | Eigen::ComputeThinV);
+size_t HistogramMedian::middle_bin(size_t &before) const {
+	size_t half = total / 2;
+	before = below;
+	for (size_t bin = 0; bin < BINS; bin++) {
+		if (before + counts[bin] > half) {
+			return bin;
+		}
+		before += counts[bin];
+	}
+	return BINS - 1;
+}
 
-	Eigen::MatrixXf U_reduced = svd.matrixU().leftCols(n_components);
+bool HistogramMedian::refine() {
+	size_t before;
+	size_t bin = middle_bin(before);
+	if (rounds >= MAX_ROUNDS || counts[bin] <= total / REFINE_SHARE) {
+		return false;
+	}
+	float width = (high - low) / BINS;
+	float bin_low = low + bin * width;
+	float bin_high = bin_low + width;
+	// the range cannot be narrowed below the float resolution
+	if (!(bin_low > low || bin_high < high) || !(bin_high > bin_low)) {
+		return false;
+	}
+	low = bin_low;
+	high = bin_high;
+	std::fill(counts.begin(), counts.end(), 0);
+	below = 0;
+	total = 0;
+	rounds++;
+	return true;
+}
 
-	components = svd.matrixV().leftCols(n_components);
-	components.transposeInPlace();
+float HistogramMedian::median() const {
+	size_t before;
+	size_t bin = middle_bin(before);
+	return low + (bin + 1) * ((high - low) / BINS);
+}
 
-	projected_data = U_reduced * svd.singularValues().head(n_components).asDiagonal();
+size_t HistogramMedian::count_below() const {
+	size_t before;
+	size_t bin = middle_bin(before);
+	return before + counts[bin];
 }
 
-void project(
-	const Eigen::MatrixXf &data,
+void Projector::compile(
+	const std::vector<size_t> &dimensions,
 	const Eigen::MatrixXf &W,
 	const Eigen::MatrixXf &b,
-	const Eigen::MatrixXf &components,
-	float &projected_value
+	const Eigen::MatrixXf &components
 ) {
-	int n_samples = data.rows();
-	int n_features = W.cols();
-
-	Eigen::MatrixXf Z(n_samples, n_features);
+	this->dimensions = dimensions;
+	size_t n_dimensions = W.rows();
+	size_t n_features = W.cols();
+	if (n_dimensions != dimensions.size() || components.cols() != static_cast<Eigen::Index>(n_features)) {
+		this->dimensions.clear();
+		weights.clear();
+		bias.clear();
+		coefficients.clear();
+		return;
+	}
 
-	for (int i = 0; i < n_samples; i++) {
-		Eigen::VectorXf x = data.row(i);
-		for (int j = 0; j < n_features; j++) {
-			Z(i, j) = std::sqrt(2.0f / n_features) * std::cos(W.col(j).transpose() * x + b(0, j));
+	weights.resize(n_dimensions * n_features);
+	for (size_t i = 0; i < n_dimensions; i++) {
+		for (size_t j = 0; j < n_features; j++) {
+			weights[i * n_features + j] = W(i, j);
 		}
 	}
+	bias.resize(n_features);
+	coefficients.resize(n_features);
+	float scale = std::sqrt(2.0f / n_features);
+	for (size_t j = 0; j < n_features; j++) {
+		bias[j] = b(0, j);
+		coefficients[j] = scale * components(0, j);
+	}
+}
+
+float Projector::max_projection() const {
+	float bound = 0.0f;
+	for (float coefficient: coefficients) {
+		bound += std::abs(coefficient);
+	}
+	// covers the error of the approximate cosine
+	return bound * (1.0f + SIMD::COS_MAX_ERROR) + SIMD::COS_MAX_ERROR;
+}
 
-	Eigen::MatrixXf projected_data = Z * components.transpose();
+bool Projector::empty() const {
+	return coefficients.empty();
+}
 
-	projected_value = projected_data(0, 0);
+float Projector::project(const float *x) const {
+	return SIMD::rff_project(
+		x, dimensions.data(), dimensions.size(),
+		weights.data(), bias.data(), coefficients.data(), coefficients.size()
+	);
 }
 
 };
-
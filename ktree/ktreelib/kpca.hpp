@@ -18,29 +18,111 @@ private:
 
 public:
 	RandomFourierFeatures(int n_features, float gamma);
-	void transform(
-		const Eigen::MatrixXf &data,
-		Eigen::MatrixXf &transformed_data,
-		Eigen::MatrixXf &Wr,
-		Eigen::MatrixXf &br
-	);
+	// draws the random weights and bias of n_original_features inputs
+	void sample(int n_original_features, Eigen::MatrixXf &Wr, Eigen::MatrixXf &br);
+};
+
+
+// eigenvector of the largest eigenvalue of a symmetric positive
+// semidefinite matrix, by power iteration. falls back to a full
+// eigendecomposition when the iteration does not converge
+void top_eigenvector(const Eigen::MatrixXd &matrix, Eigen::VectorXd &eigenvector);
+
+// principal component of the random features of a stream of points, from
+// the n_features x n_features matrix Z^T Z accumulated block by block, so
+// memory does not grow with the number of points. the component is the top
+// eigenvector of Z^T Z. blocks added to separate fits on separate threads
+// are combined by merge
+class CovarianceFit {
+private:
+	Eigen::MatrixXf W;
+	Eigen::MatrixXf b;
+	Eigen::MatrixXd covariance;
+
+public:
+	CovarianceFit(const Eigen::MatrixXf &W, const Eigen::MatrixXf &b);
+
+	// points restricted to the fitted dimensions, one per row
+	void add(const Eigen::Ref<const Eigen::MatrixXf> &rows);
+	// adds the points of a fit with the same random features
+	void merge(const CovarianceFit &other);
+	// 1 x n_features, like performPCA
+	void component(Eigen::MatrixXf &components) const;
+};
+
+// median of a stream of values from a histogram, memory does not grow with
+// the number of values. when the middle bin holds too many values its range
+// is refined and the values are streamed again
+class HistogramMedian {
+private:
+	float low;
+	float high;
+	std::vector<size_t> counts;
+	// values below low, and all the values
+	size_t below;
+	size_t total;
+	size_t rounds;
+
+	// bin holding the middle value, and the values before it
+	size_t middle_bin(size_t &before) const;
+
+public:
+	static const size_t BINS = 1 << 16;
+	// the middle bin is refined while it holds more than 1 / REFINE_SHARE
+	// of the values, at most MAX_ROUNDS times
+	static const size_t REFINE_SHARE = 1024;
+	static const size_t MAX_ROUNDS = 3;
+
+	// values are expected within [-bound, bound]
+	HistogramMedian(float bound);
+
+	void add(float value) {
+		total++;
+		if (value < low) {
+			below++;
+			return;
+		}
+		if (value >= high) {
+			return;
+		}
+		size_t bin = static_cast<size_t>((value - low) / (high - low) * BINS);
+		counts[std::min(bin, BINS - 1)]++;
+	}
+
+	// narrows the range to the middle bin when it holds too many
+	// values, returns whether to stream the values again
+	bool refine();
+
+	// upper edge of the middle bin: about half of the values are below
+	float median() const;
+	// number of values below the median
+	size_t count_below() const;
 };
 
+// projection of a fitted node compiled for routing queries:
+// gathers the node dimensions from the full vector, computes the random
+// features and their dot product with the component in one pass
+class Projector {
+private:
+	std::vector<size_t> dimensions;
+	std::vector<float> weights; // W, one row of n_features per dimension
+	std::vector<float> bias;
+	std::vector<float> coefficients; // sqrt(2 / n_features) * components
+public:
+	Projector() = default;
+
+	void compile(
+		const std::vector<size_t> &dimensions,
+		const Eigen::MatrixXf &W,
+		const Eigen::MatrixXf &b,
+		const Eigen::MatrixXf &components
+	);
+	bool empty() const;
+	float project(const float *x) const;
+	// largest absolute value of a projection
+	float max_projection() const;
+};
 
-void performPCA(
-	const Eigen::MatrixXf &transformed_data,
-	Eigen::MatrixXf &components,
-	Eigen::MatrixXf &projected_data,
-	int n_components
-);
-
-void project(
-	const Eigen::MatrixXf &data,
-	const Eigen::MatrixXf &W,
-	const Eigen::MatrixXf &b,
-	const Eigen::MatrixXf &components,
-	float &projected_value
-);
 
 };
 #endif // __KPCA_HPP__
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <iostream>
 #include <algorithm>
 #include <numeric>
+#include <cmath>
+#include <limits>
+#include <functional>
 #include <Eigen/Dense>
 
 
@@ -14,6 +17,8 @@
 #include "data.hpp"
 #include "query.hpp"
 #include "timer.hpp"
+#include "kernels.hpp"
+#include "io.hpp"
 
 #ifdef MULTITHREADED_ENABLED
 #include "threadpool.hpp"
@@ -24,12 +29,15 @@
 
 namespace KTREE {
 
-KTree::KTree(): root(nullptr) {}
+KTree::KTree(): root(nullptr), buffer_pool(nullptr), leaf_store(nullptr), quantizer(nullptr) {}
 
 KTree::~KTree() {
 	if (root != nullptr) {
 		delete root;
 	}
+	delete buffer_pool;
+	delete leaf_store;
+	delete quantizer;
 }
 
 void KTree::index(const std::string& file_path, size_t num_points) {
@@ -52,11 +60,12 @@ void KTree::index(const std::string& file_path, size_t num_points) {
 	if (root == nullptr) {
 		throw KTreeError("Failed to allocate memory for root node");
 	}
+	root->set_seed(std::random_device()());
 	// non parallel version
 
 #ifdef MULTITHREADED_ENABLED
-	THREADS::ThreadPool pool;
-	
+	THREADS::ThreadPool pool(Config::get_instance()->build_threads, Config::get_instance()->pin_threads);
+
 	pool.add_task(root);
 	pool.wait_for_completion();
 #else
@@ -77,9 +86,35 @@ void KTree::index(const std::string& file_path, size_t num_points) {
 	t.stop();
 	LOG("INDEXING TIME: " << t.to_string());
 
+	// codes are trained once on the whole dataset, then written with the leaves
+	const Config *config = Config::get_instance();
+	if (config->leaf_codes != NO_CODES) {
+		t.reset();
+		t.start();
+		delete quantizer;
+		quantizer = Quantizer::create(config->leaf_codes);
+		quantizer->train(file_path, num_points, config->dimensions);
+		t.stop();
+		LOG("QUANTIZER TRAINING TIME: " << t.to_string());
+	}
 }
 
 
+void KTree::pack_leaves() {
+	if (root == nullptr) {
+		return;
+	}
+	Timer t;
+
+	t.start();
+	const Config *config = Config::get_instance();
+	std::string codes_path = quantizer != nullptr? config->index_path + "/" + CODE_STORE_FILE: "";
+	LeafStoreWriter writer(config->index_path + "/" + LEAF_STORE_FILE, codes_path, quantizer);
+	root->pack(writer);
+	t.stop();
+	LOG("PACKING TIME: " << t.to_string());
+}
+
 void KTree::serialize(std::ofstream& out) const {
 	if (root != nullptr) {
 		out << "Y";
@@ -88,33 +123,142 @@ void KTree::serialize(std::ofstream& out) const {
 	else {
 		out << "N";
 	}
+	if (quantizer != nullptr) {
+		quantizer->serialize(out);
+	}
 }
 
 void KTree::deserialize(std::ifstream& in) {
 	char c;
 
+	// with a buffer size the leaves are only read when a query reaches them
+	const Config *config = Config::get_instance();
+	if (config->buffer_size > 0) {
+		this->buffer_pool = new BufferPool(config->buffer_size << 20);
+	}
+	if (config->leaf_storage == LeafStorage::PACKED) {
+		// the leaves are read in the order they were packed
+		bool sequential = buffer_pool == nullptr;
+		std::string codes_path = "";
+		size_t code_size = 0;
+		if (config->leaf_codes != NO_CODES) {
+			// the quantizer is read after the tree
+			codes_path = config->index_path + "/" + CODE_STORE_FILE;
+			code_size = config->leaf_codes == PQ? config->pq_subspaces: config->dimensions;
+		}
+		this->leaf_store = new LeafStore(config->index_path + "/" + LEAF_STORE_FILE, sequential, codes_path, code_size);
+	}
+
 	in >> c;
 	if (c == 'Y') {
 		this->root = new KTREE::Node();
+		this->root->set_storage(buffer_pool, leaf_store);
 		this->root->deserialize(in);
 	}	
+	if (leaf_store != nullptr && buffer_pool == nullptr) {
+		leaf_store->advise_random();
+	}
+	if (config->leaf_codes != NO_CODES) {
+		this->quantizer = Quantizer::create(config->leaf_codes);
+		this->quantizer->deserialize(in);
+	}
 
 }
 
 
 Node::Node() {
+	this->num_points = 0;
 	this->parent = nullptr;
 	this->left = nullptr;
 	this->right = nullptr;
 	this->type = NodeType::LEAF;
 	this->data = nullptr;
+	this->buffer_pool = nullptr;
+	this->leaf_store = nullptr;
+	this->store_offset = 0;
+	this->code_offset = 0;
+	this->radius = 0.0f;
+	this->seed = 0;
+}
+
+NodeSummary::NodeSummary(const Segmentation& segmentation, size_t dimensions, size_t sample_size, uint64_t seed):
+	variance(dimensions), sample(dimensions, sample_size, seed) {
+	for (size_t i = 0; i < segmentation.size(); i++) {
+		Segment segment = segmentation[i];
+		starts.push_back(segment.get_start());
+		ends.push_back(segment.get_end());
+	}
+	segments_mins.assign(starts.size(), std::numeric_limits<float>::infinity());
+	segments_maxs.assign(starts.size(), -std::numeric_limits<float>::infinity());
+}
+
+void NodeSummary::add(const float *point) {
+	for (size_t i = 0; i < starts.size(); i++) {
+		double sum = 0.0;
+		for (size_t d = starts[i]; d < ends[i]; d++) {
+			sum += point[d];
+		}
+		float mean = static_cast<float>(sum / (ends[i] - starts[i]));
+		segments_mins[i] = std::min(segments_mins[i], mean);
+		segments_maxs[i] = std::max(segments_maxs[i], mean);
+	}
+	variance.add(point);
+	sample.add(point);
+}
+
+LeafEnvelope::LeafEnvelope(size_t dimensions, size_t capacity):
+	dimensions(dimensions), capacity(capacity), count(0), sums(dimensions, 0.0),
+	mins(dimensions, std::numeric_limits<float>::infinity()), maxs(dimensions, -std::numeric_limits<float>::infinity()) {}
+
+void LeafEnvelope::add(const float *point) {
+	count++;
+	for (size_t j = 0; j < dimensions; j++) {
+		mins[j] = std::min(mins[j], point[j]);
+		maxs[j] = std::max(maxs[j], point[j]);
+		sums[j] += point[j];
+	}
+	if (count <= capacity) {
+		points.insert(points.end(), point, point + dimensions);
+	}
+	else if (!points.empty()) {
+		// the radius will be measured from the file
+		std::vector<float>().swap(points);
+	}
+}
+
+void LeafEnvelope::centroid(std::vector<float>& centroid) const {
+	centroid.resize(dimensions);
+	for (size_t j = 0; j < dimensions; j++) {
+		centroid[j] = static_cast<float>(sums[j] / std::max<size_t>(count, 1));
+	}
 }
 
-Node::Node(const std::string& file_path, const Segmentation& segmentation, size_t num_points): filename(file_path), segmentation(segmentation), num_points(num_points) {
+double LeafEnvelope::max_distance(const std::vector<float>& c) const {
+	double max_distance = 0.0;
+	for (size_t i = 0; i < points.size(); i += dimensions) {
+		double distance = 0.0;
+		for (size_t j = 0; j < dimensions; j++) {
+			double diff = static_cast<double>(points[i + j]) - c[j];
+			distance += diff * diff;
+		}
+		max_distance = std::max(max_distance, distance);
+	}
+	return max_distance;
+}
+
+Node::Node(const std::string& file_path, const Segmentation& segmentation, size_t num_points, std::unique_ptr<NodeSummary> summary, std::unique_ptr<LeafEnvelope> envelope):
+	filename(file_path), segmentation(segmentation), num_points(num_points), summary(std::move(summary)), envelope(std::move(envelope)) {
 	this->parent = nullptr;
 	this->left = nullptr;
 	this->right = nullptr;
 	this->type = NodeType::LEAF;
+	this->data = nullptr;
+	this->buffer_pool = nullptr;
+	this->leaf_store = nullptr;
+	this->store_offset = 0;
+	this->code_offset = 0;
+	this->radius = 0.0f;
+	this->seed = 0;
 }
 
 Node::~Node() {
@@ -130,7 +274,9 @@ void Node::print(int indent) const {
 	std::cout << "Node: " << this << " ";
 	if (type == NodeType::LEAF) {
 		std::cout << "LEAF";
-		std::cout << " " << data->size();
+		if (data != nullptr) {
+			std::cout << " " << data->size();
+		}
 	}
 	else {
 		std::cout << "INTERNAL";
@@ -146,90 +292,174 @@ void Node::print(int indent) const {
 	}
 }
 
-const DataContainer& Node::getData() const {
+const LeafBlock& Node::getData() const {
 	return *data;
 }
 
-void Node::quantize_segments_averages(const std::vector<float>& mins, const std::vector<float>& maxs) {
-	// TODO
+void Node::set_storage(BufferPool *buffer_pool, const LeafStore *leaf_store) {
+	this->buffer_pool = buffer_pool;
+	this->leaf_store = leaf_store;
 }
 
-void Node::compute_summary(size_t num_points) {
-	// computing the summary of the data
-	std::ifstream file(this->filename, std::ios::in | std::ios::binary);
-	if (!file.is_open()) {
-        throw std::runtime_error("Could not open the data file for reading");
-    }
+LeafBlock* Node::load_data() const {
+	LeafLayout layout = Config::get_instance()->leaf_layout;
+	if (leaf_store != nullptr) {
+		LeafBlock *view = leaf_store->view(store_offset, num_points);
+		if (leaf_store->has_codes()) {
+			// the float vectors are only read to rank the candidates left by
+			// the codes, they stay in the mapping
+			leaf_store->attach_codes(*view, code_offset, buffer_pool != nullptr);
+			return view;
+		}
+		// rows of a resident leaf are scanned straight from the mapping,
+		// the buffer pool keeps its own copies within its budget
+		if (layout == ROWS && buffer_pool == nullptr) {
+			return view;
+		}
+		LeafBlock *block = new LeafBlock(view->row(0), view->get_ids(), view->size(), view->get_dimensions(), layout);
+		delete view;
+		return block;
+	}
+	std::string full_path = Config::get_instance()->index_path + "/" + filename;
+	return LeafBlock::load_from_file(full_path, layout);
+}
 
-	size_t dimensions = KTREE::Config::get_instance()->dimensions;
+std::shared_ptr<const LeafBlock> Node::leaf_data(size_t *bytes_read) const {
+	if (buffer_pool == nullptr) {
+		// resident leaf, owned by the node
+		return std::shared_ptr<const LeafBlock>(std::shared_ptr<const LeafBlock>(), data);
+	}
+	return buffer_pool->get(this, [this, bytes_read]() {
+		LeafBlock *block = load_data();
+		if (bytes_read != nullptr) {
+			*bytes_read = block->bytes();
+		}
+		return block;
+	});
+}
 
-	// Determine the number of points to read
-    file.seekg(0, std::ios::end);
-    size_t file_size = file.tellg();
+void Node::prefetch() const {
+	if (type != NodeType::LEAF) {
+		return;
+	}
+	if (buffer_pool != nullptr) {
+		// the block stays in the pool until the scan asks for it
+		leaf_data();
+	}
+	else if (leaf_store != nullptr) {
+		leaf_store->will_need(store_offset, num_points);
+	}
+}
 
-    size_t expected_size = num_points * dimensions * sizeof(float);
-    if (file_size < expected_size) {
-        file.close();
-        throw std::runtime_error("Invalid number of points in data file");
-    }
+void Node::pack(LeafStoreWriter& writer) {
+	if (type == NodeType::INTERNAL) {
+		if (left != nullptr) {
+			left->pack(writer);
+		}
+		if (right != nullptr) {
+			right->pack(writer);
+		}
+		return;
+	}
+	std::string full_path = Config::get_instance()->index_path + "/" + filename;
+	store_offset = writer.append(full_path, num_points, code_offset);
+	if (std::remove(full_path.c_str()) != 0 || std::remove(ids_file_name(full_path).c_str()) != 0) {
+		std::perror("Error removing leaf file");
+	}
+	filename = "";
+}
 
-	size_t num_segments = this->segmentation.size();
-	std::vector<size_t> segments_sizes;
-
-	// get the sizes of the segments
-	this->segmentation.get_segments_sizes(segments_sizes);
-	// initialize the per_point_segment_averages
-	std::vector<float> per_point_segment_averages(num_segments, 0.0);
-	std::vector<float> segments_mins(num_segments, std::numeric_limits<float>::infinity());
-    std::vector<float> segments_maxs(num_segments, -std::numeric_limits<float>::infinity());
-	std::vector<float> means(dimensions, 0.0);
-	std::vector<float> means_square(dimensions, 0.0);
-    std::vector<float> variance(dimensions, 0.0);
-	// compute the per point segment averages
-	file.seekg(0, std::ios::beg);
-	// Buffered reading
-    const size_t batch_size = 1000;  // Read 1000 points at a time
-    std::vector<float> buffer(batch_size * dimensions);
-	size_t points_read = 0;
-	while (points_read < num_points) {
-		size_t to_read = std::min(batch_size, num_points - points_read);
+float Node::lower_bound(const std::vector<float>& query_representation) const {
+	// leaves that were never summarized have no envelope
+	if (segments_mins.size() != query_representation.size()) {
+		return 0.0f;
+	}
+	// for any point x of the node and any segment s of length l,
+	// ||q_s - x_s||^2 >= l * (mean(q_s) - mean(x_s))^2 and mean(x_s) lies
+	// in the segment envelope, so this is a lower bound of ||q - x||^2
+	return SIMD::envelope_bound(
+		query_representation.data(),
+		segments_mins.data(),
+		segments_maxs.data(),
+		segments_lengths.data(),
+		query_representation.size()
+	);
+}
 
-        file.read(reinterpret_cast<char*>(buffer.data()), to_read * dimensions * sizeof(float));
-		
-		
-		for (size_t i = 0; i < num_segments; i++) {
-			Segment segment = this->segmentation[i];
-			std::vector<size_t> indices = segment.get_indices();
-			for (size_t j = 0; j < to_read; j++) {
-				float sum = 0.0;
-				for (size_t index : indices) {
-                    sum += buffer[j * dimensions + index];
-                }
-				per_point_segment_averages[i] = sum / indices.size();
-				if (per_point_segment_averages[i] < segments_mins[i])
-					segments_mins[i] = per_point_segment_averages[i];
-				if (per_point_segment_averages[i] > segments_maxs[i])
-					segments_maxs[i] = per_point_segment_averages[i];
-			}
-		}
+float Node::leaf_bound(const float *query) const {
+	// internal nodes, and leaves of an empty data file, have no envelope
+	if (type != NodeType::LEAF || leaf_mins.empty() || num_points == 0) {
+		return 0.0f;
+	}
+	size_t dimensions = leaf_mins.size();
+	float box = SIMD::box_bound(query, leaf_mins.data(), leaf_maxs.data(), dimensions);
+	// ||q - x|| >= ||q - c|| - radius for any point x of the ball
+	float gap = std::sqrt(SIMD::squared_l2(query, centroid.data(), dimensions)) - radius;
+	float ball = gap > 0.0f? gap * gap: 0.0f;
+	return std::max(box, ball);
+}
 
-		for (size_t i = 0; i < to_read; i++) {
-			for (size_t dim = 0; dim < dimensions; dim++) {
-				means[dim] += buffer[i * dimensions + dim];
-				means_square[dim] += buffer[i * dimensions + dim] * buffer[i * dimensions + dim];
-			}
-		}
-		points_read += to_read;
+void Node::compute_segments_lengths() {
+	segments_lengths.resize(segmentation.size());
+	for (size_t i = 0; i < segmentation.size(); i++) {
+		segments_lengths[i] = static_cast<float>(segmentation[i].size());
 	}
+}
 
+void Node::quantize_segments_averages(const std::vector<float>& mins, const std::vector<float>& maxs) {
+	// TODO
+}
+
+// number of iterations build_parallel_for may run at the same time
+static size_t build_parallelism() {
+#ifdef MULTITHREADED_ENABLED
+	if (THREADS::ThreadPool::current() != nullptr) {
+		return THREADS::ThreadPool::current()->size();
+	}
+#endif
+	return 1;
+}
+
+// runs fn(0) ... fn(n - 1), spread over the idle build workers when
+// called from one of them
+static void build_parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+#ifdef MULTITHREADED_ENABLED
+	if (THREADS::ThreadPool::current() != nullptr) {
+		THREADS::ThreadPool::current()->parallel_for(n, fn);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < n; i++) {
+		fn(i);
+	}
+}
 
-	file.close();
+size_t Node::compute_summary(size_t num_points) {
+	size_t dimensions = KTREE::Config::get_instance()->dimensions;
+	std::vector<float> block;
+	size_t count;
+
+	if (!summary) {
+		// the points come straight from the dataset, they are summarized
+		// by a first pass, the parent summarizes the other nodes
+		summary.reset(new NodeSummary(segmentation, dimensions, KTREE::Config::get_instance()->fit_sample_size, seed));
+		BlockReader reader(this->filename, dimensions, num_points, BufferedWriter::BUFFER_BYTES, true);
+		while ((count = reader.next(block)) > 0) {
+			for (size_t i = 0; i < count; i++) {
+				summary->add(block.data() + i * dimensions);
+			}
+		}
+	}
+	size_t num_segments = this->segmentation.size();
+	segments_mins = std::move(summary->segments_mins);
+	segments_maxs = std::move(summary->segments_maxs);
+	std::vector<float> variance;
+	summary->variance.variance(variance);
+	ReservoirSample sample = std::move(summary->sample);
+	summary.reset();
 
 	this->quantize_segments_averages(segments_mins, segments_maxs);
-	for (size_t i = 0; i < dimensions; i++) {
-        means[i] /= num_points;
-		variance[i] = means_square[i]/num_points - (means[i] * means[i]);
-    }
+	this->compute_segments_lengths();
 
 	// select the top_k dimensions with the highest variance
 	std::vector<size_t> top_k_dimensions(KTREE::Config::get_instance()->top_k, 0);
@@ -286,51 +516,197 @@ void Node::compute_summary(size_t num_points) {
 	}
 
 
-	// extract the data for these best_segment_dimensions
-	file.seekg(0, std::ios::beg);
-	points_read = 0;
-	//batch_size = 1000;
-	
-	DataContainer *best_segment_data = new DataContainer(); //
-	while (points_read < num_points) {
-		size_t to_read = std::min(batch_size, num_points - points_read);
-		file.read(reinterpret_cast<char*>(buffer.data()), to_read * dimensions * sizeof(float));
-		for (size_t i = 0; i < to_read; i++) {
-			std::vector<float> best_segment_point;
-			for (size_t d : best_segment_dimensions) {
-				best_segment_point.push_back(buffer[i * dimensions + d]);
+	// fit the projection on the best_segment_dimensions of the sample, or
+	// of every point in a streaming pass. a group of blocks is read, then
+	// the random features of each block are added to the covariance of a
+	// slot by the build workers, the slots are merged at the end
+	size_t num_columns = best_segment_dimensions.size();
+	PCA::RandomFourierFeatures rff(num_columns * 2, 1.f);
+	rff.sample(num_columns, W, b);
+	size_t slots = build_parallelism();
+	std::vector<PCA::CovarianceFit> fits(slots, PCA::CovarianceFit(W, b));
+	std::vector<std::vector<float>> columns(slots);
+	auto add_points = [&](size_t slot, const float *points, size_t count) {
+		columns[slot].resize(count * num_columns);
+		for (size_t c = 0; c < num_columns; c++) {
+			float *column = columns[slot].data() + c * count;
+			size_t d = best_segment_dimensions[c];
+			for (size_t i = 0; i < count; i++) {
+				column[i] = points[i * dimensions + d];
 			}
-			DataPoint *best_segment_data_point = new DataPoint(best_segment_point);
-			best_segment_data->append(best_segment_data_point);
 		}
-
-		points_read += to_read;
+		fits[slot].add(Eigen::Map<const Eigen::MatrixXf>(columns[slot].data(), count, num_columns));
+	};
+	// the sample is cut into one chunk per slot
+	size_t chunk = (sample.size() + slots - 1) / slots;
+	std::vector<std::vector<float>> blocks(slots);
+	std::vector<size_t> counts(slots);
+	if (sample.size() > 0) {
+		build_parallel_for(slots, [&](size_t slot) {
+			size_t first = std::min(slot * chunk, sample.size());
+			size_t last = std::min(first + chunk, sample.size());
+			if (last > first) {
+				add_points(slot, sample.data() + first * dimensions, last - first);
+			}
+		});
+	}
+	else {
+		BlockReader reader(this->filename, dimensions, num_points, BufferedWriter::BUFFER_BYTES, true);
+		size_t filled;
+		do {
+			filled = 0;
+			while (filled < slots && (counts[filled] = reader.next(blocks[filled])) > 0) {
+				filled++;
+			}
+			build_parallel_for(filled, [&](size_t slot) {
+				add_points(slot, blocks[slot].data(), counts[slot]);
+			});
+		} while (filled == slots);
+	}
+	for (size_t slot = 1; slot < slots; slot++) {
+		fits[0].merge(fits[slot]);
+	}
+	fits[0].component(components);
+	columns.clear();
+	projector.compile(best_segment_dimensions, W, b, components);
+
+	if (sample.size() > 0) {
+		// median of the sampled projections, the number of points
+		// below it is estimated from the sample
+		size_t sample_size = sample.size();
+		std::vector<float> projections(sample_size);
+		build_parallel_for(slots, [&](size_t slot) {
+			size_t last = std::min((slot + 1) * chunk, sample_size);
+			for (size_t i = slot * chunk; i < last; i++) {
+				projections[i] = projector.project(sample.data() + i * dimensions);
+			}
+		});
+		auto middle = projections.begin() + sample_size / 2;
+		std::nth_element(projections.begin(), middle, projections.end());
+		median = *middle;
+		if (sample_size % 2 == 0) {
+			median = (*std::max_element(projections.begin(), middle) + median) / 2;
+		}
+		size_t below = std::count_if(projections.begin(), projections.end(), [this](float p) { return p < median; });
+		return static_cast<size_t>(std::round(static_cast<double>(below) * num_points / sample_size));
 	}
-	file.close();
-
-	// apply pca to the best segment data
-
-	Eigen::MatrixXf data;
-	best_segment_data->toEigenMatrix(data);
-	PCA::RandomFourierFeatures rff(data.cols() * 2, 1.f);
-	rff.transform(data, Z, W, b);
-	PCA::performPCA(Z, components, projected_data, 1); // why did we have 2 components again? we only need one right?
 
+	// median of the projections, streamed again when the middle bin
+	// of the histogram is refined. the blocks of a group are projected
+	// by the build workers, the histogram is filled on this thread
+	PCA::HistogramMedian histogram(projector.max_projection());
+	std::vector<std::vector<float>> projections(slots);
+	do {
+		BlockReader reader(this->filename, dimensions, num_points, BufferedWriter::BUFFER_BYTES, true);
+		size_t filled;
+		do {
+			filled = 0;
+			while (filled < slots && (counts[filled] = reader.next(blocks[filled])) > 0) {
+				filled++;
+			}
+			build_parallel_for(filled, [&](size_t slot) {
+				projections[slot].resize(counts[slot]);
+				for (size_t i = 0; i < counts[slot]; i++) {
+					projections[slot][i] = projector.project(blocks[slot].data() + i * dimensions);
+				}
+			});
+			for (size_t slot = 0; slot < filled; slot++) {
+				for (float projection: projections[slot]) {
+					histogram.add(projection);
+				}
+			}
+		} while (filled == slots);
+	} while (histogram.refine());
+	median = histogram.median();
+	return histogram.count_below();
+}
 
-	// compute the median
-	std::vector<float> medians;
-	for (int i = 0; i < projected_data.rows(); i++) {
-		for (int j = 0; j < projected_data.cols(); j++) {
-			medians.push_back(projected_data(i, j));
+void Node::make_leaf(size_t num_points) {
+	this->type = NodeType::LEAF;
+	std::string old_ = filename;
+	this->choose_file_name();
+	std::string index_dir = KTREE::Config::get_instance()->index_path;
+	std::string new_ = index_dir + "/" + filename;
+	size_t dimensions = KTREE::Config::get_instance()->dimensions;
+	size_t leaf_size = KTREE::Config::get_instance()->leaf_size;
+	// the parent gathered the envelope while it wrote the file, unless it
+	// expected the node to be split and gathered its summary instead,
+	// which a leaf does not need
+	summary.reset();
+	if (envelope && envelope->size() != num_points) {
+		envelope.reset();
+	}
+	// only the files written by a split belong to the build, the points of
+	// the root come from the dataset, which is copied and left in place
+	bool disposable = old_.find("disposable") != std::string::npos;
+	if (!disposable) {
+		envelope.reset(new LeafEnvelope(dimensions, leaf_size));
+		BlockReader reader(old_, dimensions, num_points, BufferedWriter::BUFFER_BYTES, true);
+		BufferedWriter writer(new_);
+		std::vector<float> block;
+		size_t count;
+		while ((count = reader.next(block)) > 0) {
+			writer.write(block.data(), count * dimensions * sizeof(float));
+			for (size_t i = 0; i < count; i++) {
+				envelope->add(block.data() + i * dimensions);
+			}
 		}
+		writer.close();
 	}
-	std::sort(medians.begin(), medians.end());
-	if (medians.size() % 2 == 0) {
-		median = (medians[medians.size() / 2 - 1] + medians[medians.size() / 2]) / 2;
+	else if (std::rename(old_.c_str(), new_.c_str()) != 0) {
+		std::perror("Error renaming file");
 	}
-	else {
-		median = medians[medians.size() / 2];
+	if (!envelope) {
+		envelope.reset(new LeafEnvelope(dimensions, leaf_size));
+		BlockReader reader(new_, dimensions, num_points, BufferedWriter::BUFFER_BYTES, true);
+		std::vector<float> block;
+		size_t count;
+		while ((count = reader.next(block)) > 0) {
+			for (size_t i = 0; i < count; i++) {
+				envelope->add(block.data() + i * dimensions);
+			}
+		}
+	}
+	compute_leaf_envelope(new_, *envelope);
+	envelope.reset();
+	if (disposable) {
+		if (std::rename(ids_file_name(old_).c_str(), ids_file_name(new_).c_str()) != 0) {
+			std::perror("Error renaming file");
+		}
+		return;
+	}
+	// the points were read straight from the dataset
+	std::vector<PointId> ids(num_points);
+	std::iota(ids.begin(), ids.end(), 0);
+	std::ofstream out(ids_file_name(new_), std::ios::out | std::ios::binary);
+	out.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(PointId));
+}
+
+void Node::compute_leaf_envelope(const std::string& file_path, const LeafEnvelope& envelope) {
+	leaf_mins = envelope.mins;
+	leaf_maxs = envelope.maxs;
+	envelope.centroid(centroid);
+	double max_distance = envelope.max_distance(centroid);
+	if (!envelope.has_points()) {
+		// too many points to keep, the radius takes a second pass
+		size_t dimensions = centroid.size();
+		BlockReader reader(file_path, dimensions, envelope.size(), BufferedWriter::BUFFER_BYTES, true);
+		std::vector<float> block;
+		size_t count;
+		while ((count = reader.next(block)) > 0) {
+			for (size_t i = 0; i < count; i++) {
+				const float *point = block.data() + i * dimensions;
+				double distance = 0.0;
+				for (size_t j = 0; j < dimensions; j++) {
+					double diff = static_cast<double>(point[j]) - centroid[j];
+					distance += diff * diff;
+				}
+				max_distance = std::max(max_distance, distance);
+			}
+		}
 	}
+	// rounded up so that the ball holds every point
+	radius = std::nextafter(static_cast<float>(std::sqrt(max_distance)), std::numeric_limits<float>::infinity());
 }
 
 void Node::split(size_t num_points) {
@@ -338,41 +714,23 @@ void Node::split(size_t num_points) {
 		return;
 	}
 	if (this->parent && num_points <= Config::get_instance()->leaf_size) {
-		this->type = NodeType::LEAF;
-		std::string old_ = filename;
-		this->choose_file_name();
-		std::string index_dir = KTREE::Config::get_instance()->index_path;
-		std::string new_ = index_dir + "/" + filename;
-		if (std::rename(old_.c_str(), new_.c_str()) != 0) {
-        	std::perror("Error renaming file");
-    	}
+		this->make_leaf(num_points);
 		return;
 	} // if it was a leaf it would already have it's file
+	// the node was expected to be a leaf
+	envelope.reset();
 	
-	this->compute_summary(num_points);
+	size_t expected_l = this->compute_summary(num_points);
+	size_t expected_r = num_points - expected_l;
 
 	// check if spliting the segment is possible
 	if (segmentation[best_segment_index].size() <= 1) {
 		// we should set this node to LEAF
-		this->type = NodeType::LEAF;
-		this->choose_file_name();
-		data->save_to_file(filename);
+		// the node data is already in its own file
+		this->make_leaf(num_points);
 		return;
 	}
 
-	// split the data into two parts
-	std::vector<size_t> left_indices;
-	std::vector<size_t> right_indices;
-
-	for (int i = 0; i < projected_data.rows(); i++) {
-		if (projected_data(i, 0) < median) {
-			left_indices.push_back(i);
-		}
-		else {
-			right_indices.push_back(i);
-		}
-	}
-
 	Segmentation child_segmentation(segmentation);
 
 
@@ -388,48 +746,76 @@ void Node::split(size_t num_points) {
 	std::string full_path_left_data = index_dir + "/" + filename_left_data;
 	std::string full_path_right_data = index_dir + "/" + filename_right_data;
 
-	std::ofstream file_left(full_path_left_data, std::ios::out | std::ios::binary);
-	if (!file_left.is_open()) {
-		throw std::runtime_error("Could not open the file for writing");
-	}
-	std::ofstream file_right(full_path_right_data, std::ios::out | std::ios::binary);
-	if (!file_right.is_open()) {
-		throw std::runtime_error("Could not open the file for writing");
-	}
-	
-	std::ifstream file(filename, std::ios::in | std::ios::binary);
+	BufferedWriter file_left(full_path_left_data);
+	BufferedWriter file_right(full_path_right_data);
+	// the ids of the points follow them into the children
+	BufferedWriter ids_left(ids_file_name(full_path_left_data));
+	BufferedWriter ids_right(ids_file_name(full_path_right_data));
 
-	if (!file.is_open()) {
-		throw std::runtime_error("Could not open the data file for reading");
-	}
 	size_t dimensions = KTREE::Config::get_instance()->dimensions;
-	file.seekg(0, std::ios::end);
-	const size_t batch_size = 1000;
+	// children that will be split are summarized while their files are
+	// written, they do not read them again for it. the expected sizes come
+	// from the histogram or the sample of the median, a child summarizes
+	// itself when the estimate made it miss
+	size_t leaf_size = KTREE::Config::get_instance()->leaf_size;
+	size_t sample_size = KTREE::Config::get_instance()->fit_sample_size;
+	uint64_t seed_l = mix_seed(2 * seed + 1);
+	uint64_t seed_r = mix_seed(2 * seed + 2);
+	std::unique_ptr<NodeSummary> summary_l(expected_l > leaf_size? new NodeSummary(child_segmentation, dimensions, sample_size, seed_l): nullptr);
+	std::unique_ptr<NodeSummary> summary_r(expected_r > leaf_size? new NodeSummary(child_segmentation, dimensions, sample_size, seed_r): nullptr);
+	// children that will be leaves gather their envelope instead
+	std::unique_ptr<LeafEnvelope> envelope_l(summary_l? nullptr: new LeafEnvelope(dimensions, leaf_size));
+	std::unique_ptr<LeafEnvelope> envelope_r(summary_r? nullptr: new LeafEnvelope(dimensions, leaf_size));
+
+	BlockReader file(filename, dimensions, num_points, BufferedWriter::BUFFER_BYTES, true);
+	// no ids file when the points come straight from the dataset
+	std::ifstream ids_file(ids_file_name(filename), std::ios::in | std::ios::binary);
 	
 	size_t num_points_l = 0;
 	size_t num_points_r = 0;
-	std::vector<float> buffer(batch_size * dimensions);  
+	std::vector<float> buffer;
+	std::vector<PointId> ids_buffer;
 	size_t points_read = 0;
-	while (points_read < num_points) {
-		size_t to_read = std::min(batch_size, num_points - points_read);
-		file.read(reinterpret_cast<char*>(buffer.data()), to_read * dimensions * sizeof(float));
+	size_t to_read;
+	while ((to_read = file.next(buffer)) > 0) {
+		ids_buffer.resize(to_read);
+		if (ids_file.is_open()) {
+			ids_file.read(reinterpret_cast<char*>(ids_buffer.data()), to_read * sizeof(PointId));
+		}
+		else {
+			std::iota(ids_buffer.begin(), ids_buffer.end(), points_read);
+		}
 		for (size_t i = 0; i < to_read; i++) {
-			if (std::find(right_indices.begin(), right_indices.end(), points_read + i) != right_indices.end())
-			{
-				file_right.write(reinterpret_cast<char*>(&buffer[i * dimensions]), dimensions * sizeof(float));
+			const float *point = &buffer[i * dimensions];
+			if (!(projector.project(point) < median)) {
+				file_right.write(point, dimensions * sizeof(float));
+				ids_right.write(&ids_buffer[i], sizeof(PointId));
+				if (summary_r) {
+					summary_r->add(point);
+				}
+				else {
+					envelope_r->add(point);
+				}
 				num_points_r++;
 			}
-			if (std::find(left_indices.begin(), left_indices.end(), points_read + i) != left_indices.end())
-			{
-				file_left.write(reinterpret_cast<char*>(&buffer[i * dimensions]), dimensions * sizeof(float));
+			else {
+				file_left.write(point, dimensions * sizeof(float));
+				ids_left.write(&ids_buffer[i], sizeof(PointId));
+				if (summary_l) {
+					summary_l->add(point);
+				}
+				else {
+					envelope_l->add(point);
+				}
 				num_points_l++;
 			}
 		}
 		points_read += to_read;
 	}
-	file.close();
 	file_right.close();
 	file_left.close();
+	ids_right.close();
+	ids_left.close();
 
 	// clean up
 	if (filename.find("disposable") != std::string::npos)
@@ -437,15 +823,21 @@ void Node::split(size_t num_points) {
 		if (std::remove(filename.c_str()) != 0) {
         	std::perror("Error deleting file");
     	}
+		if (ids_file.is_open()) {
+			ids_file.close();
+			std::remove(ids_file_name(filename).c_str());
+		}
 	}
 
-	if (left_indices.size() != 0) {
-		this->left = new Node(full_path_left_data, child_segmentation, num_points_l);
+	if (num_points_l != 0) {
+		this->left = new Node(full_path_left_data, child_segmentation, num_points_l, std::move(summary_l), std::move(envelope_l));
 		this->left->setParent(this);
+		this->left->set_seed(seed_l);
 	}
-	if (right_indices.size() != 0) {
-		this->right = new Node(full_path_right_data, child_segmentation, num_points_r);
+	if (num_points_r != 0) {
+		this->right = new Node(full_path_right_data, child_segmentation, num_points_r, std::move(summary_r), std::move(envelope_r));
 		this->right->setParent(this);
+		this->right->set_seed(seed_r);
 	}
 	// set the type to internal
 	this->type = NodeType::INTERNAL;
@@ -515,9 +907,13 @@ void Node::setRight(Node *right) {
 	this->right = right;
 }
 
+void Node::set_seed(uint64_t seed) {
+	this->seed = seed;
+}
+
 size_t Node::size() const { // I don t think we need this check
 	if (type == NodeType::LEAF) {
-		return data->size();
+		return leaf_data()->size();
 	}
 	return left->size() + right->size();
 }
@@ -544,6 +940,17 @@ void Node::serialize(std::ofstream& out) const {
 	// serialize the filename
 	KTREE::serialize(filename, out);
 
+	// serialize the leaf block in the packed store
+	KTREE::serialize(num_points, out);
+	KTREE::serialize(store_offset, out);
+	KTREE::serialize(code_offset, out);
+
+	// serialize the leaf envelope
+	KTREE::serialize(leaf_mins, out);
+	KTREE::serialize(leaf_maxs, out);
+	KTREE::serialize(centroid, out);
+	KTREE::serialize(radius, out);
+
 	// serialze the median
 	KTREE::serialize(median, out);
 	
@@ -554,8 +961,6 @@ void Node::serialize(std::ofstream& out) const {
 	// serialize the kpca summary
 	KTREE::serialize(W, out);
 	KTREE::serialize(b, out);
-	KTREE::serialize(Z, out);
-	KTREE::serialize(projected_data, out);
 	KTREE::serialize(components, out);
 
 	// serialize the left and right nodes
@@ -594,10 +999,22 @@ void Node::deserialize(std::ifstream& in) {
 
 	// deserialize the segmentation
 	segmentation.deserialize(in);
+	compute_segments_lengths();
 
 	// deserialize the filename
 	KTREE::deserialize(filename, in);
 
+	// deserialize the leaf block in the packed store
+	KTREE::deserialize(num_points, in);
+	KTREE::deserialize(store_offset, in);
+	KTREE::deserialize(code_offset, in);
+
+	// deserialize the leaf envelope
+	KTREE::deserialize(leaf_mins, in);
+	KTREE::deserialize(leaf_maxs, in);
+	KTREE::deserialize(centroid, in);
+	KTREE::deserialize(radius, in);
+
 	// deserialize the median
 	KTREE::deserialize(median, in);
 
@@ -609,13 +1026,15 @@ void Node::deserialize(std::ifstream& in) {
 	// deserialize the kpca summary
 	KTREE::deserialize(W, in);
 	KTREE::deserialize(b, in);
-	KTREE::deserialize(Z, in);
-	KTREE::deserialize(projected_data, in);
 	KTREE::deserialize(components, in);
+	if (type == NodeType::INTERNAL) {
+		projector.compile(best_segment_dimensions, W, b, components);
+	}
 
 	in >> c;
 	if (c == 'Y') {
 		left = new Node();
+		left->set_storage(buffer_pool, leaf_store);
 		left->deserialize(in);
 		left->setParent(this);
 	}
@@ -626,6 +1045,7 @@ void Node::deserialize(std::ifstream& in) {
 	in >> c;
 	if (c == 'Y') {
 		right = new Node();
+		right->set_storage(buffer_pool, leaf_store);
 		right->deserialize(in);
 		right->setParent(this);
 	}
@@ -633,11 +1053,9 @@ void Node::deserialize(std::ifstream& in) {
 		right = nullptr;
 	}
 
-	// read the data if it's a leaf node
-	if (type == NodeType::LEAF) {
-
-		std::string full_path = Config::get_instance()->index_path + "/" + filename;
-		data = DataContainer::load_from_file(full_path, true);
+	// read the data if it's a leaf node, unless it is loaded lazily
+	if (type == NodeType::LEAF && buffer_pool == nullptr) {
+		data = load_data();
 	}
 }
 
@@ -2,9 +2,14 @@
 #define __KTREE_HPP__
 
 #include <vector>
+#include <algorithm>
 #include <Eigen/Dense>
 #include <stack>
 #include <set>
+#include <queue>
+#include <functional>
+#include <memory>
+#include <unordered_set>
 
 
 #include "data.hpp"
@@ -12,6 +17,15 @@
 #include "serialization.hpp"
 #include "query.hpp"
 #include "kpca.hpp"
+#include "config.hpp"
+#include "bufferpool.hpp"
+#include "leafstore.hpp"
+#include "utils.hpp"
+#include "error.hpp"
+
+#ifdef MULTITHREADED_ENABLED
+#include "threadpool.hpp"
+#endif
 
 
 
@@ -24,14 +38,67 @@ enum class NodeType {
 };
 
 
+// statistics of the points of a node gathered in one streaming pass:
+// the envelope of the segment means and the variance of every dimension
+class NodeSummary {
+private:
+	// segment i covers the dimensions [starts[i], ends[i])
+	std::vector<size_t> starts;
+	std::vector<size_t> ends;
+
+public:
+	std::vector<float> segments_mins;
+	std::vector<float> segments_maxs;
+	RunningVariance variance;
+	// points the split of the node is fitted on, when sampling is enabled
+	ReservoirSample sample;
+
+	NodeSummary(const Segmentation& segmentation, size_t dimensions, size_t sample_size = 0, uint64_t seed = 0);
+
+	void add(const float *point);
+};
+
+// bounding box and centroid of the points of a leaf gathered in one
+// streaming pass. up to capacity points are kept, so that the radius around
+// the centroid is measured without reading the points again
+class LeafEnvelope {
+private:
+	size_t dimensions;
+	size_t capacity;
+	size_t count;
+	std::vector<double> sums;
+	std::vector<float> points;
+
+public:
+	std::vector<float> mins;
+	std::vector<float> maxs;
+
+	LeafEnvelope(size_t dimensions, size_t capacity);
+
+	void add(const float *point);
+
+	size_t size() const {
+		return count;
+	}
+	// whether every point added was kept
+	bool has_points() const {
+		return count <= capacity;
+	}
+	void centroid(std::vector<float>& centroid) const;
+	// largest squared distance between c and a kept point
+	double max_distance(const std::vector<float>& c) const;
+};
+
+
 class Node: public Serializable {
 private:
 	Node *parent;
 	Node *left, *right;
 	NodeType type;
-	DataContainer *data;
+	LeafBlock *data;
 	std::vector<float> segments_mins;
 	std::vector<float> segments_maxs;
+	std::vector<float> segments_lengths;
 	Segmentation segmentation;
 
 	std::string filename;
@@ -44,18 +111,51 @@ private:
 	// KPCA
 	Eigen::MatrixXf W;
 	Eigen::MatrixXf b;
-	Eigen::MatrixXf Z;
-	Eigen::MatrixXf projected_data; // don t need to keep this
 	Eigen::MatrixXf components;
 
+	// routing kernel compiled from the KPCA summary
+	PCA::Projector projector;
+
+	// when set, leaf data is loaded through the pool on first access
+	BufferPool *buffer_pool;
+	// when set, leaf data is a block of the packed leaf store
+	const LeafStore *leaf_store;
+	size_t store_offset;
+	size_t code_offset;
+
+	// tight envelope of the points of a leaf, kept in memory so that a
+	// leaf can be ruled out before its data is fetched: the bounding box
+	// of the points, and the ball around their centroid
+	std::vector<float> leaf_mins;
+	std::vector<float> leaf_maxs;
+	std::vector<float> centroid;
+	float radius;
+
+	// summary gathered by the parent while it wrote the node file,
+	// null for the root, released once the node is summarized
+	std::unique_ptr<NodeSummary> summary;
+	// likewise for a node expected to be a leaf
+	std::unique_ptr<LeafEnvelope> envelope;
+	// seeds the sample of the node points, the seeds of the children are
+	// derived from it so the build draws a single random seed
+	uint64_t seed;
+
 private:
-	void compute_summary(size_t num_points);
+	// fits the projection and its median, returns the number of points
+	// below the median, estimated when the fit is sampled
+	size_t compute_summary(size_t num_points);
+	void compute_segments_lengths();
+	// turns the node into a leaf owning its data and ids files
+	void make_leaf(size_t num_points);
+	// box and ball of the leaf from its envelope, the points are only
+	// read again when the envelope did not keep them
+	void compute_leaf_envelope(const std::string& file_path, const LeafEnvelope& envelope);
 	std::string choose_disposable_file_name(size_t n);
 	void choose_file_name();
 
 public:
 	Node();
-	Node(const std::string& file_path, const Segmentation& segmentation, size_t num_points);
+	Node(const std::string& file_path, const Segmentation& segmentation, size_t num_points, std::unique_ptr<NodeSummary> summary = nullptr, std::unique_ptr<LeafEnvelope> envelope = nullptr);
 	~Node();
 
 	Node& operator=(const Node &node) = delete;
@@ -63,7 +163,22 @@ public:
 	NodeType getType() const;
 	size_t getNum_points() const;
 	void setType(NodeType type);
-	const DataContainer& getData() const;
+	const LeafBlock& getData() const;
+	void set_storage(BufferPool *buffer_pool, const LeafStore *leaf_store);
+
+	// moves the data of every leaf below this node into the packed store
+	void pack(LeafStoreWriter& writer);
+	// reads the leaf data from its file, or from its block of the
+	// packed store without copying it when the layout allows
+	LeafBlock* load_data() const;
+
+	// points of the leaf, loaded through the buffer pool if any.
+	// bytes_read, if given, is set to the bytes loaded on a pool miss
+	std::shared_ptr<const LeafBlock> leaf_data(size_t *bytes_read = nullptr) const;
+
+	// reads the leaf ahead of its scan: into the buffer pool, or a hint
+	// to the kernel for a leaf viewed in the packed store
+	void prefetch() const;
 
 	Node *getParent() const;
 	void setParent(Node *parent);
@@ -71,6 +186,7 @@ public:
 	void setLeft(Node *left);
 	Node* getRight() const;
 	void setRight(Node *right);
+	void set_seed(uint64_t seed);
 	size_t size() const;
 	void quantize_segments_averages(const std::vector<float>& mins, const std::vector<float>& maxs);
 
@@ -89,6 +205,10 @@ public:
 		return segmentation;
 	}
 
+	size_t get_best_segment_index() const {
+		return best_segment_index;
+	}
+
 	void print(int indent = 0) const;
 
 	void count(unsigned int* counter) const {
@@ -106,47 +226,143 @@ public:
 		}
 	}
 
+	// lower bound of the squared distance between the query and the node's
+	// points, from the query representation under the node's segmentation
+	float lower_bound(const std::vector<float>& query_representation) const;
+
+	// lower bound of the squared distance between the query and the points
+	// of a leaf from its own envelope, 0 for an internal node
+	float leaf_bound(const float *query) const;
+
+	// bound of a child of a node whose bound is parent_bound
+	float child_bound(float parent_bound, const std::vector<float>& query_representation, const float *query) const {
+		float bound = std::max(parent_bound, lower_bound(query_representation));
+		if (type == NodeType::LEAF) {
+			bound = std::max(bound, leaf_bound(query));
+		}
+		return bound;
+	}
+
+	// Q is any query type accepting candidates through add_result and add_group,
+	// bound is the lower bound the leaf was reached with
+	template<typename Q>
+	void scan(Q& query, [[maybe_unused]] float bound = 0.0f) const {
+		query.increment_leaf_count();
+#ifdef QUERY_STATS_ENABLED
+		QueryStats& stats = query.get_stats();
+		size_t bytes_read = 0;
+		std::shared_ptr<const LeafBlock> block = timed(stats.io_time, [&]() { return leaf_data(&bytes_read); });
+		if (bytes_read > 0) {
+			stats.leaves_read++;
+			stats.bytes_read += bytes_read;
+		}
+		timed(stats.scan_time, [&]() { scan_block(query, *block); });
+		stats.record_scan(bound, query.best_distance());
+#else
+		scan_block(query, *leaf_data());
+#endif
+	}
+
+	template<typename Q>
+	void scan_block(Q& query, const LeafBlock& block) const {
+		if (block.has_codes()) {
+			for (size_t i = 0; i < block.size(); i++) {
+				query.add_coded(block.code(i), block.code_error(i), block.row(i), block.id(i));
+			}
+			return;
+		}
+		if (block.get_layout() == GROUPED) {
+			for (size_t g = 0; g < block.num_groups(); g++) {
+				size_t first = g * SIMD::POINT_GROUP;
+				query.add_group(block.group(g), block.get_ids() + first, std::min(SIMD::POINT_GROUP, block.size() - first));
+			}
+			return;
+		}
+		for (size_t i = 0; i < block.size(); i++) {
+			query.add_result(block.row(i), block.id(i));
+		}
+	}
+
+	// leaf scan that can run concurrently with scans of other leaves,
+	// bound is the lower bound the leaf was reached with
+	template<typename T>
+	void scan_shared(Query<T>& query, [[maybe_unused]] float bound = 0.0f) const {
+#ifdef QUERY_STATS_ENABLED
+		// statistics of this leaf, merged with those of the query
+		QueryStats leaf;
+		size_t bytes_read = 0;
+		std::shared_ptr<const LeafBlock> block = timed(leaf.io_time, [&]() { return leaf_data(&bytes_read); });
+		if (bytes_read > 0) {
+			leaf.leaves_read++;
+			leaf.bytes_read += bytes_read;
+		}
+		size_t distances = timed(leaf.scan_time, [&]() { return scan_block_shared(query, *block); });
+		query.add_shared_stats(leaf, bound);
+#else
+		size_t distances = scan_block_shared(query, *leaf_data());
+#endif
+		query.add_shared_counts(1, distances);
+	}
+
+	// returns the number of distances computed
+	template<typename T>
+	size_t scan_block_shared(Query<T>& query, const LeafBlock& block) const {
+		if (block.has_codes()) {
+			size_t distances = 0;
+			for (size_t i = 0; i < block.size(); i++) {
+				distances += query.add_coded_shared(block.code(i), block.code_error(i), block.row(i), block.id(i));
+			}
+			return distances;
+		}
+		if (block.get_layout() == GROUPED) {
+			for (size_t g = 0; g < block.num_groups(); g++) {
+				size_t first = g * SIMD::POINT_GROUP;
+				query.add_group_shared(block.group(g), block.get_ids() + first, std::min(SIMD::POINT_GROUP, block.size() - first));
+			}
+			return block.size();
+		}
+		for (size_t i = 0; i < block.size(); i++) {
+			query.add_result_shared(block.row(i), block.id(i));
+		}
+		return block.size();
+	}
+
 	template<typename T>
-	void search(Query<T>& query, std::stack<Node *>& stack) {
+	void search(Query<T>& query, std::stack<const Node *>& stack) const {
 		query.increment_visit_count();
 		// SEARCHING DOWN THE TREE
 		// TILL WE REACH THE FIRST LEAF NODE
 
 		stack.push(this);
 		if (this->type == NodeType::LEAF) {
-			for (size_t i = 0; i < data->size(); i++) {
-				query.add_result((*data)[i]);
+			// the first leaf reached is scanned unless its own
+			// envelope rules it out
+			float bound = STATS_TIMED(query.get_stats().bound_time, leaf_bound(query.get_query().data()));
+			if (bound >= query.kth_distance()) {
+				query.add_pruned_count(1);
+				STATS(query.get_stats().leaves_pruned++);
+				query.add_unexplored_bound(bound);
+				return;
 			}
+			scan(query, bound);
 			return;
 		}
 		else { // internal node
-			std::vector<float> selected_query_data;
-			for (auto d: best_segment_dimensions) {
-				selected_query_data.push_back(query.get_query()[d]);
-			}
+			STATS(query.get_stats().internal_visited++);
 			// project the query data
-			Eigen::MatrixXf query_data(1, selected_query_data.size());
-			for (size_t i = 0; i < selected_query_data.size(); i++) {
-				query_data(0, i) = selected_query_data[i];
-			}
-			float projected_value;
-			PCA::project(query_data, W, b, components, projected_value);
-			if (projected_value <= median) {
-				if (left != nullptr) {
-					left->search(query, stack);
-				}
-				else {
-					right->search(query, stack);
-				}
+			float projected_value = projector.project(query.get_query().data());
+			Node *next = projected_value <= median? left: right;
+			Node *other = projected_value <= median? right: left;
+			if (next == nullptr) {
+				std::swap(next, other);
 			}
-			else {
-				if (right != nullptr) {
-					right->search(query, stack);
-				}
-				else {
-					left->search(query, stack);
-				}
+			// the other child is not searched, its points are only
+			// bounded by its lower bound
+			if (other != nullptr) {
+				const std::vector<float>& query_representation = query.get_representation(other->get_segmentation());
+				query.add_unexplored_bound(STATS_TIMED(query.get_stats().bound_time, other->lower_bound(query_representation)));
 			}
+			next->search(query, stack);
 		}
 
 			// if (opposite_node != nullptr) {
@@ -163,27 +379,316 @@ public:
 };
 
 
+struct NodeBound {
+	float bound;
+	Node *node;
+
+	bool operator>(const NodeBound& other) const {
+		return bound > other.bound;
+	}
+};
+
+
+// frontier of the best first search, smallest bound at the top
+class NodeQueue: public std::priority_queue<NodeBound, std::vector<NodeBound>, std::greater<NodeBound>> {
+public:
+	// number of queued leaves
+	size_t count_leaves() const {
+		return std::count_if(c.begin(), c.end(), [](const NodeBound& entry) {
+			return entry.node->getType() == NodeType::LEAF;
+		});
+	}
+
+	// the leaves among the count nodes that would be popped next,
+	// in increasing order of bound, the queue is left untouched
+	void next_leaves(size_t count, std::vector<NodeBound>& leaves) const {
+		leaves.clear();
+		// best first walk of the heap, entry i is the parent of 2i + 1 and 2i + 2
+		std::vector<std::pair<float, size_t>> frontier;
+		auto closer = [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+			return a.first > b.first;
+		};
+		if (!c.empty()) {
+			frontier.push_back({c[0].bound, 0});
+		}
+		for (size_t visited = 0; visited < count && !frontier.empty(); visited++) {
+			std::pop_heap(frontier.begin(), frontier.end(), closer);
+			size_t i = frontier.back().second;
+			frontier.pop_back();
+			if (c[i].node->getType() == NodeType::LEAF) {
+				leaves.push_back(c[i]);
+			}
+			for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < c.size(); child++) {
+				frontier.push_back({c[child].bound, child});
+				std::push_heap(frontier.begin(), frontier.end(), closer);
+			}
+		}
+	}
+};
+
+
+// leaves already read ahead by one search
+struct PrefetchState {
+	std::unordered_set<const Node *> requested;
+	std::vector<NodeBound> next_leaves;
+#ifdef MULTITHREADED_ENABLED
+	std::shared_ptr<THREADS::Prefetcher::Ticket> ticket;
+#endif
+};
+
+
 class KTree: public Serializable {
 private:
 	Node *root;
+	BufferPool *buffer_pool;
+	LeafStore *leaf_store;
+	// set when the leaves are stored with codes
+	Quantizer *quantizer;
 public:
 	KTree();
 	~KTree();
 
 	void index(const std::string& file_path, size_t num_points);
-	
+	// replaces the leaf files with a single packed leaf store
+	void pack_leaves();
+
+	// the tree is not modified while searching, concurrent searches
+	// are safe as long as each one uses its own Query
 	template<typename T>
-	void search(Query<T>& query) {
+	void search(Query<T>& query) const {
+		const Config *config = Config::get_instance();
+		query.set_quantizer(quantizer);
+		// pq codes rank the points of the approximate modes by themselves
+		query.set_code_ranking(config->leaf_codes == PQ && config->search_mode != SearchMode::EXACT, config->rerank);
+		switch (config->search_mode) {
+			case SearchMode::EXACT:
+				search_best_first(query, 0.0f, 0);
+				break;
+			case SearchMode::EPSILON:
+				search_best_first(query, config->epsilon, 0);
+				break;
+			case SearchMode::BUDGET:
+				search_best_first(query, 0.0f, config->leaf_budget);
+				break;
+			case SearchMode::TOP_DOWN:
+				search_top_down(query);
+				break;
+			case SearchMode::RANGE:
+				// radius queries go through search_range
+				throw InvalidArguments<std::string>("search_mode", search_mode_name(config->search_mode));
+		}
+		query.rerank_candidates();
+	}
+
+	// depth first search of the points within the query radius,
+	// a node is pruned once its lower bound exceeds the squared radius
+	template<typename T>
+	void search_range(RangeQuery<T>& query) const {
+		if (root == nullptr) {
+			return;
+		}
+		query.set_quantizer(quantizer);
+		const float squared_radius = query.get_squared_radius();
+		std::stack<NodeBound> stack;
+
+		stack.push({0.0f, root});
+		while (!stack.empty()) {
+			NodeBound current = stack.top();
+			stack.pop();
+			query.increment_visit_count();
+
+			Node *node = current.node;
+			if (node->getType() == NodeType::LEAF) {
+				node->scan(query, current.bound);
+				continue;
+			}
+			STATS(query.get_stats().internal_visited++);
+
+			Node *children[] = {node->getLeft(), node->getRight()};
+			const std::vector<float> *query_representation = nullptr;
+			for (Node *child: children) {
+				if (child == nullptr) {
+					continue;
+				}
+				if (query_representation == nullptr) {
+					query_representation = &query.get_representation(child->get_segmentation());
+				}
+				float bound = STATS_TIMED(query.get_stats().bound_time, child->child_bound(current.bound, *query_representation, query.get_query().data()));
+				if (bound <= squared_radius) {
+					stack.push({bound, child});
+				}
+				else {
+					query.add_pruned_count(1);
+					STATS(query.get_stats().leaves_pruned += child->getType() == NodeType::LEAF);
+				}
+			}
+		}
+	}
+
+	// nodes are expanded in increasing order of their lower bound.
+	// a node is pruned once bound * (1 + epsilon) reaches the k-th best
+	// distance, epsilon = 0 gives the exact answer. a non zero leaf_budget
+	// stops the search after that many leaves. the smallest bound left
+	// unexplored is recorded in the query
+	template<typename T>
+	void search_best_first(Query<T>& query, float epsilon, size_t leaf_budget) const {
+		if (root == nullptr) {
+			return;
+		}
+		const float factor = 1.0f + epsilon;
+		const size_t prefetch = Config::get_instance()->prefetch;
+		NodeQueue queue;
+		PrefetchState prefetch_state;
+
+		queue.push({0.0f, root});
+		while (!queue.empty()) {
+			NodeBound current = queue.top();
+			if (current.bound * factor >= query.kth_distance()) {
+				// every queued node is at least as far
+				break;
+			}
+			if (leaf_budget != 0 && current.node->getType() == NodeType::LEAF && query.get_leaf_count() >= leaf_budget) {
+				break;
+			}
+			queue.pop();
+			query.increment_visit_count();
+
+			Node *node = current.node;
+			if (node->getType() == NodeType::LEAF) {
+				if (prefetch > 0) {
+					// the leaves next in line are read while this one is scanned
+					prefetch_frontier(query, queue, prefetch, factor, prefetch_state);
+				}
+#ifdef MULTITHREADED_ENABLED
+				if (query.get_scan_pool() != nullptr) {
+					scan_leaves_parallel(query, current, queue, factor, leaf_budget);
+					continue;
+				}
+#endif
+				node->scan(query, current.bound);
+				continue;
+			}
+			STATS(query.get_stats().internal_visited++);
+
+			Node *children[] = {node->getLeft(), node->getRight()};
+			const std::vector<float> *query_representation = nullptr;
+			for (Node *child: children) {
+				if (child == nullptr) {
+					continue;
+				}
+				// both children share the same segmentation
+				if (query_representation == nullptr) {
+					query_representation = &query.get_representation(child->get_segmentation());
+				}
+				float bound = STATS_TIMED(query.get_stats().bound_time, child->child_bound(current.bound, *query_representation, query.get_query().data()));
+				if (bound * factor < query.kth_distance()) {
+					queue.push({bound, child});
+				}
+				else {
+					query.add_pruned_count(1);
+					STATS(query.get_stats().leaves_pruned += child->getType() == NodeType::LEAF);
+					query.add_unexplored_bound(bound);
+				}
+			}
+		}
+
+		// the queue is a heap, its smallest bound is at the top
+		if (!queue.empty()) {
+			query.add_pruned_count(queue.size());
+			STATS(query.get_stats().leaves_pruned += queue.count_leaves());
+			query.add_unexplored_bound(queue.top().bound);
+		}
+#ifdef MULTITHREADED_ENABLED
+		if (prefetch_state.ticket) {
+			prefetch_state.ticket->closed.store(true, std::memory_order_relaxed);
+		}
+#endif
+	}
+
+	// starts reading the leaves among the next count nodes of the queue:
+	// through the prefetch workers when leaves are loaded into the buffer
+	// pool, with a kernel hint when they are viewed in the packed store
+	template<typename T>
+	void prefetch_frontier(Query<T>& query, const NodeQueue& queue, size_t count, float factor, PrefetchState& state) const {
+		bool background = false;
+#ifdef MULTITHREADED_ENABLED
+		if (buffer_pool != nullptr && query.get_prefetcher() != nullptr) {
+			if (!state.ticket) {
+				state.ticket = std::make_shared<THREADS::Prefetcher::Ticket>();
+			}
+			state.ticket->threshold.store(query.kth_distance(), std::memory_order_relaxed);
+			background = true;
+		}
+#endif
+		if (buffer_pool != nullptr && !background) {
+			// a blocking read would gain nothing over the scan itself
+			return;
+		}
+		queue.next_leaves(count, state.next_leaves);
+		for (const NodeBound& next: state.next_leaves) {
+			if (!state.requested.insert(next.node).second) {
+				continue;
+			}
+#ifdef MULTITHREADED_ENABLED
+			if (background) {
+				query.get_prefetcher()->submit(next.node, next.bound * factor, state.ticket);
+				continue;
+			}
+#endif
+			next.node->prefetch();
+		}
+	}
+
+#ifdef MULTITHREADED_ENABLED
+	// scans the given leaf together with the leaves at the front of the
+	// queue, on the scan pool, while they are still worth visiting
+	template<typename T>
+	void scan_leaves_parallel(Query<T>& query, const NodeBound& first, NodeQueue& queue, float factor, size_t leaf_budget) const {
+		THREADS::ScanPool *pool = query.get_scan_pool();
+		size_t max_batch = pool->size() + 1;
+		if (leaf_budget != 0) {
+			max_batch = std::min(max_batch, leaf_budget - query.get_leaf_count());
+		}
+		std::vector<NodeBound> batch = {first};
+		while (batch.size() < max_batch && !queue.empty()) {
+			const NodeBound& next = queue.top();
+			if (next.node->getType() != NodeType::LEAF || next.bound * factor >= query.kth_distance()) {
+				break;
+			}
+			batch.push_back(next);
+			queue.pop();
+			query.increment_visit_count();
+		}
+		if (batch.size() == 1) {
+			first.node->scan(query, first.bound);
+			return;
+		}
+
+		query.begin_shared();
+		pool->parallel_for(batch.size(), [&query, &batch, factor](size_t i) {
+			// the threshold may have tightened since the leaf was queued
+			if (batch[i].bound * factor >= query.get_shared_kth_distance()) {
+				query.add_shared_unexplored(batch[i].bound);
+				return;
+			}
+			batch[i].node->scan_shared(query, batch[i].bound);
+		});
+	}
+#endif
+
+	// descends to the first leaf without backtracking, the lower bound of
+	// every node left behind is recorded as unexplored
+	template<typename T>
+	void search_top_down(Query<T>& query) const {
 		if (root != nullptr) {
-			std::vector<float> query_representation;
 			float distance = std::numeric_limits<float>::max();
 
-			std::stack<Node *> stack;
+			std::stack<const Node *> stack;
 			root->search(query, stack);
 
 #ifndef TOP_DOWN_SEARCH_PRUNING
 			while (!stack.empty()) {
-				Node *node = stack.top();
+				const Node *node = stack.top();
 				stack.pop();
 				Node *parent = node->getParent();
 				if (parent != nullptr) {
@@ -197,44 +702,54 @@ public:
 					}
 					if (opposite_node != nullptr) {
 						// we need to check if we want to visit this opposite node
-						std::stack<Node *> tmp_stack;
+						std::stack<const Node *> tmp_stack;
 						if (opposite_node->getType() == NodeType::LEAF) {
 							opposite_node->search(query, tmp_stack);
 						}
 						else {
-							query_representation.clear();
-							query_representation = query.get_query().get_representation(opposite_node->get_segmentation());
-							const std::vector<float>& opposite_mins = opposite_node->get_segments_mins();
-							const std::vector<float>& opposite_maxs = opposite_node->get_segments_maxs();
-							distance = 0.0f;
-							for (size_t i = 0; i < query_representation.size(); i++) {
-								if (query_representation[i] > opposite_maxs[i]) {
-									distance += std::abs(query_representation[i] - opposite_maxs[i]);
-								} else if (query_representation[i] < opposite_mins[i]) {
-									distance += std::abs(query_representation[i] - opposite_mins[i]);
-								}
-								else {
-									distance += 0.0f;
-								}
-							}
-							DataPoint *best_result = query.best_result();
-							float distance_to_bsf = query.get_results()->get_comparator().get_metric()(*best_result, query.get_query());
-							if (distance < distance_to_bsf) {
+							const std::vector<float>& query_representation = query.get_representation(opposite_node->get_segmentation());
+							distance = opposite_node->lower_bound(query_representation);
+							if (distance < query.kth_distance()) {
 								opposite_node->search(query, tmp_stack);
 							}
+							else {
+								query.add_unexplored_bound(distance);
+							}
 						}
 					}
 				}
 			}
 #else
-			Node *current_node = root;
-			std::stack<Node *> tmp_stack;
+			const Node *current_node = root;
+			std::stack<const Node *> tmp_stack;
+			// lower bound of the current node, every child is bounded by it too
+			float current_bound = 0.0f;
 			while (current_node) {
+				STATS(query.get_stats().internal_visited++);
 				Node *children[] = {
 					current_node->getLeft(), 
 					current_node->getRight()
 				};
 
+				float distance_to_children[2] = {
+					std::numeric_limits<float>::max(),
+					std::numeric_limits<float>::max()
+				};
+
+				// the children share the segmentation of the current node split
+				// at its best segment, below the root only those two means change
+				const Segmentation& child_segmentation = (children[0] != nullptr? children[0]: children[1])->get_segmentation();
+				const std::vector<float>& query_representation = current_node == root?
+					query.get_representation(child_segmentation):
+					query.split_representation(child_segmentation, current_node->get_best_segment_index());
+
+				for (size_t i = 0; i < sizeof(children) / sizeof(Node *); i++) {
+					Node *child = children[i];
+					if (child != nullptr) {
+						distance_to_children[i] = std::max(current_bound, STATS_TIMED(query.get_stats().bound_time, child->lower_bound(query_representation)));
+					}
+				}
+
 				// check for leaf nodes
 				bool leaf_node_reached = false;
 
@@ -248,42 +763,22 @@ public:
 					}
 				}
 				if (leaf_node_reached) {
-					break;
-				}
-
-
-				float distance_to_children[2] = {
-					std::numeric_limits<float>::max(),
-					std::numeric_limits<float>::max()
-				};
-
-				for (size_t i = 0; i < sizeof(children) / sizeof(Node *); i++) {
-					Node *child = children[i];
-					float distance = 0.0f;
-					query_representation.clear();
-					query_representation = query.get_query().get_representation(child->get_segmentation());
-					const std::vector<float>& child_mins = child->get_segments_mins();
-					const std::vector<float>& child_maxs = child->get_segments_maxs();
-					distance = 0.0f;
-					for (size_t i = 0; i < query_representation.size(); i++) {
-						if (query_representation[i] > child_maxs[i]) {
-							distance += std::abs(query_representation[i] - child_maxs[i]);
-						} else if (query_representation[i] < child_mins[i]) {
-							distance += std::abs(query_representation[i] - child_mins[i]);
-						}
-						else {
-							distance += 0.0f;
+					// an internal sibling of the leaves is not searched
+					for (size_t i = 0; i < sizeof(children) / sizeof(Node *); i++) {
+						if (children[i] != nullptr && children[i]->getType() != NodeType::LEAF) {
+							query.add_unexplored_bound(distance_to_children[i]);
 						}
 					}
-					distance_to_children[i] = distance;
+					break;
 				}
 
-				if (distance_to_children[0] < distance_to_children[1]) {
-					current_node = current_node->getLeft();
-				}
-				else {
-					current_node = current_node->getRight();
+				// the child left behind bounds the points that are not searched
+				size_t next = distance_to_children[0] < distance_to_children[1]? 0: 1;
+				if (children[1 - next] != nullptr) {
+					query.add_unexplored_bound(distance_to_children[1 - next]);
 				}
+				current_node = children[next];
+				current_bound = distance_to_children[next];
 			}
 #endif
 		}
@@ -294,6 +789,11 @@ public:
 	Node* get_root() const {
 		return root;
 	}
+
+	// null when every leaf is loaded with the index
+	const BufferPool* get_buffer_pool() const {
+		return buffer_pool;
+	}
 	void serialize(std::ofstream& out) const override;
 	void deserialize(std::ifstream& in) override;
 
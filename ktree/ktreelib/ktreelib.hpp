@@ -6,5 +6,6 @@
 #include "config.hpp"
 
 #include "index.hpp"
+#include "groundtruth.hpp"
 
 #endif // __TEST_HPP__
\ No newline at end of file
@@ -0,0 +1,188 @@
+#include "leafstore.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "config.hpp"
+
+
+namespace KTREE {
+
+LeafStoreWriter::LeafStoreWriter(const std::string& path, const std::string& codes_path, const Quantizer *quantizer):
+	offset(0), quantizer(quantizer), codes_offset(0) {
+	out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		throw std::runtime_error("Could not open the leaf store for writing");
+	}
+	if (quantizer != nullptr) {
+		codes_out.open(codes_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!codes_out.is_open()) {
+			throw std::runtime_error("Could not open the code store for writing");
+		}
+	}
+}
+
+LeafStoreWriter::~LeafStoreWriter() {
+	out.close();
+	if (codes_out.is_open()) {
+		codes_out.close();
+	}
+}
+
+void LeafStoreWriter::pad(std::ofstream& stream, size_t& position, size_t alignment) {
+	size_t padding = (alignment - position % alignment) % alignment;
+	if (padding > 0) {
+		std::vector<char> zeros(padding, 0);
+		stream.write(zeros.data(), padding);
+		position += padding;
+	}
+}
+
+size_t LeafStoreWriter::append(const std::string& leaf_file, size_t& num_points, size_t& code_offset) {
+	std::ifstream in(leaf_file, std::ios::in | std::ios::binary);
+	if (!in.is_open()) {
+		throw std::runtime_error("Could not open the leaf file for reading");
+	}
+	in.seekg(0, std::ios::end);
+	size_t size = in.tellg();
+	in.seekg(0, std::ios::beg);
+	num_points = size / (Config::get_instance()->dimensions * sizeof(float));
+	size = num_points * Config::get_instance()->dimensions * sizeof(float);
+
+	std::vector<char> buffer(size);
+	in.read(buffer.data(), size);
+	in.close();
+
+	std::ifstream ids_in(ids_file_name(leaf_file), std::ios::in | std::ios::binary);
+	if (!ids_in.is_open()) {
+		throw std::runtime_error("Could not open the ids file for reading");
+	}
+	std::vector<PointId> ids(num_points);
+	ids_in.read(reinterpret_cast<char*>(ids.data()), ids.size() * sizeof(PointId));
+	ids_in.close();
+
+	size_t block_offset = offset;
+	out.write(buffer.data(), size);
+	out.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(PointId));
+	offset += size + ids.size() * sizeof(PointId);
+
+	// pad up to the next page
+	pad(out, offset, LEAF_BLOCK_ALIGNMENT);
+	if (!out.good()) {
+		throw std::runtime_error("Could not write to the leaf store");
+	}
+
+	code_offset = codes_offset;
+	if (quantizer != nullptr) {
+		// the codes of every point, then the reconstruction errors
+		size_t dimensions = Config::get_instance()->dimensions;
+		size_t code_size = quantizer->code_size();
+		const float *rows = reinterpret_cast<const float *>(buffer.data());
+		std::vector<uint8_t> codes(num_points * code_size);
+		std::vector<float> errors(num_points);
+		for (size_t i = 0; i < num_points; i++) {
+			errors[i] = quantizer->encode(rows + i * dimensions, codes.data() + i * code_size);
+		}
+		codes_out.write(reinterpret_cast<const char*>(codes.data()), codes.size());
+		codes_offset += codes.size();
+		pad(codes_out, codes_offset, sizeof(float));
+		codes_out.write(reinterpret_cast<const char*>(errors.data()), errors.size() * sizeof(float));
+		codes_offset += errors.size() * sizeof(float);
+		pad(codes_out, codes_offset, CODE_BLOCK_ALIGNMENT);
+		if (!codes_out.good()) {
+			throw std::runtime_error("Could not write to the code store");
+		}
+	}
+	return block_offset;
+}
+
+
+// read only mapping of a whole file, null for an empty file
+static char* map_file(const std::string& path, bool sequential, size_t& length) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Could not open the leaf store for reading");
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error("Could not stat the leaf store");
+	}
+	length = st.st_size;
+	if (length == 0) {
+		close(fd);
+		return nullptr;
+	}
+	void *address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid once the file is closed
+	close(fd);
+	if (address == MAP_FAILED) {
+		throw std::runtime_error("Could not map the leaf store");
+	}
+	madvise(address, length, sequential? MADV_SEQUENTIAL: MADV_RANDOM);
+	return static_cast<char *>(address);
+}
+
+LeafStore::LeafStore(const std::string& path, bool sequential, const std::string& codes_path, size_t code_size):
+	mapping(nullptr), length(0), codes_mapping(nullptr), codes_length(0), code_size(code_size) {
+	mapping = map_file(path, sequential, length);
+	if (!codes_path.empty()) {
+		codes_mapping = map_file(codes_path, sequential, codes_length);
+	}
+}
+
+LeafStore::~LeafStore() {
+	if (mapping != nullptr) {
+		munmap(mapping, length);
+	}
+	if (codes_mapping != nullptr) {
+		munmap(codes_mapping, codes_length);
+	}
+}
+
+LeafBlock* LeafStore::view(size_t offset, size_t num_points) const {
+	size_t dimensions = Config::get_instance()->dimensions;
+	size_t values_size = num_points * dimensions * sizeof(float);
+	if (offset + values_size + num_points * sizeof(PointId) > length) {
+		throw std::runtime_error("Leaf block outside of the leaf store");
+	}
+	const float *rows = reinterpret_cast<const float *>(mapping + offset);
+	const PointId *ids = reinterpret_cast<const PointId *>(mapping + offset + values_size);
+	return new LeafBlock(rows, ids, num_points, dimensions);
+}
+
+void LeafStore::attach_codes(LeafBlock& block, size_t code_offset, bool copy) const {
+	size_t codes_size = block.size() * code_size;
+	size_t errors_offset = code_offset + (codes_size + sizeof(float) - 1) / sizeof(float) * sizeof(float);
+	if (errors_offset + block.size() * sizeof(float) > codes_length) {
+		throw std::runtime_error("Code block outside of the code store");
+	}
+	const uint8_t *codes = reinterpret_cast<const uint8_t *>(codes_mapping + code_offset);
+	const float *errors = reinterpret_cast<const float *>(codes_mapping + errors_offset);
+	block.set_codes(codes, errors, code_size, copy);
+}
+
+void LeafStore::will_need(size_t offset, size_t num_points) const {
+	if (mapping == nullptr) {
+		return;
+	}
+	// madvise needs a page aligned address, blocks are page aligned
+	size_t size = num_points * Config::get_instance()->dimensions * sizeof(float);
+	madvise(mapping + offset, std::min(size, length - offset), MADV_WILLNEED);
+}
+
+void LeafStore::advise_random() const {
+	if (mapping != nullptr) {
+		madvise(mapping, length, MADV_RANDOM);
+	}
+	if (codes_mapping != nullptr) {
+		madvise(codes_mapping, codes_length, MADV_RANDOM);
+	}
+}
+
+};
@@ -0,0 +1,83 @@
+#ifndef __LEAFSTORE_HPP__
+#define __LEAFSTORE_HPP__
+
+#include <string>
+#include <fstream>
+
+#include "data.hpp"
+#include "quantizer.hpp"
+
+namespace KTREE {
+
+// every leaf block starts on a page boundary of the packed file
+const size_t LEAF_BLOCK_ALIGNMENT = 4096;
+
+// code blocks are aligned for the SIMD kernels only
+const size_t CODE_BLOCK_ALIGNMENT = 64;
+
+// names of the packed leaf files inside the index directory
+const std::string LEAF_STORE_FILE = "leaves.bin";
+const std::string CODE_STORE_FILE = "codes.bin";
+
+// appends leaves to a packed leaf file while the index is saved,
+// and their codes to a packed code file when a quantizer is given
+class LeafStoreWriter {
+private:
+	std::ofstream out;
+	size_t offset;
+
+	const Quantizer *quantizer;
+	std::ofstream codes_out;
+	size_t codes_offset;
+
+	void pad(std::ofstream& stream, size_t& position, size_t alignment);
+
+public:
+	LeafStoreWriter(const std::string& path, const std::string& codes_path = "", const Quantizer *quantizer = nullptr);
+	~LeafStoreWriter();
+
+	// copies the points of a leaf file and their ids into the next
+	// block, returns the offset of that block. code_offset receives
+	// the offset of the block of their codes
+	size_t append(const std::string& leaf_file, size_t& num_points, size_t& code_offset);
+};
+
+// read only memory map of a packed leaf file,
+// and of its packed code file if any
+class LeafStore {
+private:
+	char *mapping;
+	size_t length;
+	char *codes_mapping;
+	size_t codes_length;
+	size_t code_size;
+
+public:
+	// sequential is advised while every leaf is loaded at once,
+	// random access otherwise. code_size is the size of the codes of a point
+	LeafStore(const std::string& path, bool sequential, const std::string& codes_path = "", size_t code_size = 0);
+	LeafStore(const LeafStore&) = delete;
+	~LeafStore();
+
+	// the block of num_points points starting at offset, a view of
+	// the mapping: the points followed by their ids
+	LeafBlock* view(size_t offset, size_t num_points) const;
+
+	bool has_codes() const {
+		return codes_mapping != nullptr;
+	}
+
+	// attaches to block the codes starting at code_offset,
+	// copied out of the mapping when copy is set
+	void attach_codes(LeafBlock& block, size_t code_offset, bool copy) const;
+
+	// hints the kernel that the block will be read soon
+	void will_need(size_t offset, size_t num_points) const;
+
+	// access pattern of the whole mapping from now on
+	void advise_random() const;
+};
+
+};
+
+#endif // __LEAFSTORE_HPP__
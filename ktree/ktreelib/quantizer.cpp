@@ -0,0 +1,222 @@
+#include "quantizer.hpp"
+
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "kernels.hpp"
+#include "error.hpp"
+
+
+namespace KTREE {
+
+Quantizer* Quantizer::create(LeafCodes codes) {
+	switch (codes) {
+		case SQ8:
+			return new ScalarQuantizer();
+		case PQ:
+			return new ProductQuantizer(Config::get_instance()->pq_subspaces);
+		default:
+			return nullptr;
+	}
+}
+
+float Quantizer::threshold(float bound, float error) {
+	// |d(q, x) - d(q, x')| <= d(x, x') by the triangle inequality
+	float distance = std::sqrt(bound) + error;
+	return distance * distance * (1.0f + SLACK);
+}
+
+void ScalarQuantizer::train(const std::string& file_path, size_t num_points, size_t dimensions) {
+	std::ifstream file(file_path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open the data file for reading");
+	}
+	std::vector<float> maxs(dimensions, -std::numeric_limits<float>::infinity());
+	mins.assign(dimensions, std::numeric_limits<float>::infinity());
+
+	const size_t batch_size = 1000;
+	std::vector<float> buffer(batch_size * dimensions);
+	size_t points_read = 0;
+	while (points_read < num_points) {
+		size_t to_read = std::min(batch_size, num_points - points_read);
+		file.read(reinterpret_cast<char*>(buffer.data()), to_read * dimensions * sizeof(float));
+		if (!file) {
+			throw std::runtime_error("Invalid number of points in data file");
+		}
+		for (size_t i = 0; i < to_read; i++) {
+			for (size_t j = 0; j < dimensions; j++) {
+				float value = buffer[i * dimensions + j];
+				mins[j] = std::min(mins[j], value);
+				maxs[j] = std::max(maxs[j], value);
+			}
+		}
+		points_read += to_read;
+	}
+
+	scales.resize(dimensions);
+	for (size_t j = 0; j < dimensions; j++) {
+		scales[j] = (maxs[j] - mins[j]) / 255.0f;
+	}
+}
+
+float ScalarQuantizer::encode(const float *x, uint8_t *codes) const {
+	double error = 0.0;
+	for (size_t j = 0; j < mins.size(); j++) {
+		float code = scales[j] > 0.0f? std::nearbyint((x[j] - mins[j]) / scales[j]): 0.0f;
+		codes[j] = static_cast<uint8_t>(std::min(std::max(code, 0.0f), 255.0f));
+		double diff = static_cast<double>(x[j]) - (static_cast<double>(mins[j]) + static_cast<double>(scales[j]) * codes[j]);
+		error += diff * diff;
+	}
+	// rounded up so that the bound stays conservative
+	return std::nextafter(static_cast<float>(std::sqrt(error)), std::numeric_limits<float>::infinity());
+}
+
+void ScalarQuantizer::prepare(const float *q, std::vector<float>& state) const {
+	state.resize(mins.size());
+	for (size_t j = 0; j < mins.size(); j++) {
+		state[j] = q[j] - mins[j];
+	}
+}
+
+float ScalarQuantizer::distance(const std::vector<float>& state, const uint8_t *codes, float threshold) const {
+	return SIMD::sq8_l2(state.data(), scales.data(), codes, mins.size(), threshold);
+}
+
+void ScalarQuantizer::serialize(std::ofstream& out) const {
+	KTREE::serialize(mins, out);
+	KTREE::serialize(scales, out);
+}
+
+void ScalarQuantizer::deserialize(std::ifstream& in) {
+	KTREE::deserialize(mins, in);
+	KTREE::deserialize(scales, in);
+}
+
+
+void ProductQuantizer::train(const std::string& file_path, size_t num_points, size_t dimensions) {
+	size_t subspaces = code_size();
+	if (subspaces == 0 || subspaces > dimensions) {
+		throw InvalidArguments<size_t>("pq_subspaces", subspaces);
+	}
+	for (size_t j = 0; j <= subspaces; j++) {
+		offsets[j] = j * dimensions / subspaces;
+	}
+
+	std::ifstream file(file_path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Could not open the data file for reading");
+	}
+	// every stride-th point, spread over the whole file
+	size_t sample_size = std::min(num_points, SAMPLE_PER_CENTROID * SIMD::ADC_TABLE_WIDTH);
+	size_t stride = num_points / sample_size;
+	std::vector<float> sample(sample_size * dimensions);
+
+	const size_t batch_size = 1000;
+	std::vector<float> buffer(batch_size * dimensions);
+	size_t points_read = 0;
+	size_t sampled = 0;
+	while (points_read < num_points && sampled < sample_size) {
+		size_t to_read = std::min(batch_size, num_points - points_read);
+		file.read(reinterpret_cast<char*>(buffer.data()), to_read * dimensions * sizeof(float));
+		if (!file) {
+			throw std::runtime_error("Invalid number of points in data file");
+		}
+		for (size_t i = 0; i < to_read && sampled < sample_size; i++) {
+			if ((points_read + i) % stride == 0) {
+				std::copy(buffer.begin() + i * dimensions, buffer.begin() + (i + 1) * dimensions, sample.begin() + sampled * dimensions);
+				sampled++;
+			}
+		}
+		points_read += to_read;
+	}
+
+	// lloyd iterations per subspace, started from sample points
+	centroids.assign(dimensions * SIMD::ADC_TABLE_WIDTH, 0.0f);
+	for (size_t j = 0; j < subspaces; j++) {
+		size_t n = length(j);
+		for (size_t c = 0; c < SIMD::ADC_TABLE_WIDTH; c++) {
+			const float *start = sample.data() + (c * sample_size / SIMD::ADC_TABLE_WIDTH) * dimensions + offsets[j];
+			for (size_t i = 0; i < n; i++) {
+				centroids[centroid_index(j, c, i)] = start[i];
+			}
+		}
+
+		std::vector<double> sums(SIMD::ADC_TABLE_WIDTH * n);
+		std::vector<size_t> counts(SIMD::ADC_TABLE_WIDTH);
+		for (size_t iteration = 0; iteration < ITERATIONS; iteration++) {
+			std::fill(sums.begin(), sums.end(), 0.0);
+			std::fill(counts.begin(), counts.end(), 0);
+			for (size_t p = 0; p < sample_size; p++) {
+				const float *x = sample.data() + p * dimensions + offsets[j];
+				size_t c = nearest(j, x);
+				counts[c]++;
+				for (size_t i = 0; i < n; i++) {
+					sums[c * n + i] += x[i];
+				}
+			}
+			// an empty cluster keeps its centroid
+			for (size_t c = 0; c < SIMD::ADC_TABLE_WIDTH; c++) {
+				if (counts[c] == 0) {
+					continue;
+				}
+				for (size_t i = 0; i < n; i++) {
+					centroids[centroid_index(j, c, i)] = static_cast<float>(sums[c * n + i] / counts[c]);
+				}
+			}
+		}
+	}
+}
+
+void ProductQuantizer::distances(size_t subspace, const float *x, float *distances) const {
+	const float *groups = centroids.data() + offsets[subspace] * SIMD::ADC_TABLE_WIDTH;
+	size_t group_size = length(subspace) * SIMD::POINT_GROUP;
+	for (size_t g = 0; g < SIMD::ADC_TABLE_WIDTH / SIMD::POINT_GROUP; g++) {
+		SIMD::squared_l2_group(x, groups + g * group_size, length(subspace), distances + g * SIMD::POINT_GROUP);
+	}
+}
+
+size_t ProductQuantizer::nearest(size_t subspace, const float *x) const {
+	float values[SIMD::ADC_TABLE_WIDTH];
+	distances(subspace, x, values);
+	return std::min_element(values, values + SIMD::ADC_TABLE_WIDTH) - values;
+}
+
+float ProductQuantizer::encode(const float *x, uint8_t *codes) const {
+	double error = 0.0;
+	for (size_t j = 0; j < code_size(); j++) {
+		size_t c = nearest(j, x + offsets[j]);
+		codes[j] = static_cast<uint8_t>(c);
+		for (size_t i = 0; i < length(j); i++) {
+			double diff = static_cast<double>(x[offsets[j] + i]) - static_cast<double>(centroids[centroid_index(j, c, i)]);
+			error += diff * diff;
+		}
+	}
+	// rounded up so that the bound stays conservative
+	return std::nextafter(static_cast<float>(std::sqrt(error)), std::numeric_limits<float>::infinity());
+}
+
+void ProductQuantizer::prepare(const float *q, std::vector<float>& state) const {
+	state.resize(code_size() * SIMD::ADC_TABLE_WIDTH);
+	for (size_t j = 0; j < code_size(); j++) {
+		distances(j, q + offsets[j], state.data() + j * SIMD::ADC_TABLE_WIDTH);
+	}
+}
+
+float ProductQuantizer::distance(const std::vector<float>& state, const uint8_t *codes, float threshold) const {
+	return SIMD::adc_l2(state.data(), codes, code_size(), threshold);
+}
+
+void ProductQuantizer::serialize(std::ofstream& out) const {
+	KTREE::serialize(offsets, out);
+	KTREE::serialize(centroids, out);
+}
+
+void ProductQuantizer::deserialize(std::ifstream& in) {
+	KTREE::deserialize(offsets, in);
+	KTREE::deserialize(centroids, in);
+}
+
+};
@@ -0,0 +1,126 @@
+#ifndef __QUANTIZER_HPP__
+#define __QUANTIZER_HPP__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "serialization.hpp"
+#include "config.hpp"
+#include "kernels.hpp"
+
+namespace KTREE {
+
+// compressed copy of the points scanned before their float vectors.
+// the code distance of a point is the squared distance between the query
+// and the reconstruction of the point
+class Quantizer: public Serializable {
+public:
+	// relative slack of the pruning thresholds,
+	// covers the rounding of the float kernels
+	static constexpr float SLACK = 1e-4f;
+
+	// empty quantizer of the given codes, to be trained or deserialized
+	static Quantizer* create(LeafCodes codes);
+
+	// trains on the first num_points points of a data file
+	virtual void train(const std::string& file_path, size_t num_points, size_t dimensions) = 0;
+
+	// bytes of the codes of one point
+	virtual size_t code_size() const = 0;
+
+	// writes the codes of x, returns an upper bound of the
+	// distance (not squared) between x and its reconstruction
+	virtual float encode(const float *x, uint8_t *codes) const = 0;
+
+	// per query state of the code distances, computed once per query
+	virtual void prepare(const float *q, std::vector<float>& state) const = 0;
+
+	// squared distance between the query of a prepared state and the
+	// reconstruction of codes, stops early once it reaches threshold
+	virtual float distance(const std::vector<float>& state, const uint8_t *codes, float threshold) const = 0;
+
+	// a point whose code distance reaches the threshold is at a squared
+	// distance of at least bound from the query, error is the distance
+	// between the point and its reconstruction
+	static float threshold(float bound, float error);
+};
+
+// 8 bit scalar quantization with a minimum and a scale per dimension,
+// value x of dimension i is stored as round((x - mins[i]) / scales[i])
+class ScalarQuantizer: public Quantizer {
+private:
+	std::vector<float> mins;
+	std::vector<float> scales;
+
+public:
+	ScalarQuantizer() = default;
+
+	// per dimension ranges of the data
+	void train(const std::string& file_path, size_t num_points, size_t dimensions) override;
+
+	size_t code_size() const override {
+		return mins.size();
+	}
+	float encode(const float *x, uint8_t *codes) const override;
+	// the query minus the per dimension minimums
+	void prepare(const float *q, std::vector<float>& state) const override;
+	float distance(const std::vector<float>& state, const uint8_t *codes, float threshold) const override;
+
+	void serialize(std::ofstream& out) const override;
+	void deserialize(std::ifstream& in) override;
+};
+
+// product quantization: the dimensions are cut into contiguous subspaces
+// and each subspace of a point is stored as the index of its closest
+// centroid, one byte per subspace
+class ProductQuantizer: public Quantizer {
+private:
+	// subspace j covers the dimensions [offsets[j], offsets[j + 1])
+	std::vector<size_t> offsets;
+	// centroids of subspace j start at offsets[j] * ADC_TABLE_WIDTH, in
+	// groups of POINT_GROUP centroids stored dimension by dimension so
+	// that the distances to a whole group take a single kernel call
+	std::vector<float> centroids;
+
+	// training sample size and k-means iterations
+	static const size_t SAMPLE_PER_CENTROID = 32;
+	static const size_t ITERATIONS = 10;
+
+	size_t length(size_t subspace) const {
+		return offsets[subspace + 1] - offsets[subspace];
+	}
+	// value i of centroid c of a subspace
+	size_t centroid_index(size_t subspace, size_t c, size_t i) const {
+		size_t group = c / SIMD::POINT_GROUP;
+		return offsets[subspace] * SIMD::ADC_TABLE_WIDTH + (group * length(subspace) + i) * SIMD::POINT_GROUP + c % SIMD::POINT_GROUP;
+	}
+
+	// squared distances between x restricted to a subspace and
+	// every centroid of that subspace
+	void distances(size_t subspace, const float *x, float *distances) const;
+	// closest centroid of a subspace to x restricted to that subspace
+	size_t nearest(size_t subspace, const float *x) const;
+
+public:
+	explicit ProductQuantizer(size_t subspaces = 0): offsets(subspaces + 1, 0) {}
+
+	// k-means of every subspace on an evenly strided sample of the data
+	void train(const std::string& file_path, size_t num_points, size_t dimensions) override;
+
+	size_t code_size() const override {
+		return offsets.size() - 1;
+	}
+	float encode(const float *x, uint8_t *codes) const override;
+	// squared distances between the query and every centroid,
+	// ADC_TABLE_WIDTH per subspace
+	void prepare(const float *q, std::vector<float>& state) const override;
+	float distance(const std::vector<float>& state, const uint8_t *codes, float threshold) const override;
+
+	void serialize(std::ofstream& out) const override;
+	void deserialize(std::ifstream& in) override;
+};
+
+};
+
+#endif // __QUANTIZER_HPP__
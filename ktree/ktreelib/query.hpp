@@ -1,7 +1,22 @@
 #ifndef __QUERY_HPP__
 #define __QUERY_HPP__
 
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
 #include "data.hpp"
+#include "kernels.hpp"
+#include "quantizer.hpp"
+#include "stats.hpp"
+
+namespace THREADS {
+class ScanPool;
+class Prefetcher;
+}
 
 namespace KTREE {
 
@@ -11,53 +26,125 @@ public:
 	virtual ~DistanceMetric() {}
 };
 
+// squared euclidean distance, computed by the SIMD kernel
+// picked for this cpu
 class EuclideanDistance: public DistanceMetric {
 public:
 	float operator() (const DataPoint& a, const DataPoint& b) const override {
-		float sum = 0;
-		for (size_t i = 0; i < a.size(); i++) {
-			sum += (a[i] - b[i]) * (a[i] - b[i]);
-		}
-		return sum;
+		return SIMD::squared_l2(a.data(), b.data(), a.size());
+	}
+
+	// stops early once the distance reaches threshold,
+	// the returned value is then >= threshold
+	float operator() (const float *a, const float *b, size_t n, float threshold) const {
+		return SIMD::squared_l2(a, b, n, threshold);
+	}
+
+	// distances between q and a group of the grouped leaf layout
+	void group(const float *q, const float *group, size_t n, float *distances, float threshold) const {
+		SIMD::squared_l2_group(q, group, n, distances, threshold);
 	}
 };
 
-template <typename T>
-class ResultContainer;
+struct Result {
+	float distance;
+	PointId id;
+
+	bool operator<(const Result& other) const {
+		return distance < other.distance;
+	}
+};
 
 template <typename T>
-class DataPointComparator;
+class ResultContainer;
 
 
-template<typename T = EuclideanDistance>
-class Query {
-private:
+// state common to every query type: the query point, the search
+// counters and the segment means of the query
+class QueryBase {
+protected:
 	DataPoint *query;
-	ResultContainer<T> *results;
 	size_t distance_computation;
 	size_t visit_count;
+	size_t leaf_count;
+	size_t pruned_count;
+
+	// prefix sums of the query, segment means are O(1) lookups
+	// written into a buffer reused for the whole query
+	std::vector<double> prefix_sums;
+	std::vector<float> representation;
+
+	// leaves stored as codes are scanned with a per query
+	// state of the quantizer, such as a distance table
+	const Quantizer *quantizer;
+	std::vector<float> code_state;
+
+#ifdef QUERY_STATS_ENABLED
+	QueryStats stats;
+#endif
+
+	QueryBase(DataPoint *query): query(query), distance_computation(0), visit_count(0), leaf_count(0), pruned_count(0), quantizer(nullptr) {
+		compute_prefix_sums();
+	}
+	QueryBase(const QueryBase&) = delete;
+
+	void compute_prefix_sums() {
+		if (query == nullptr) {
+			return;
+		}
+		prefix_sums.resize(query->size() + 1);
+		prefix_sums[0] = 0.0;
+		for (size_t i = 0; i < query->size(); i++) {
+			prefix_sums[i + 1] = prefix_sums[i] + (*query)[i];
+		}
+		representation.reserve(query->size());
+		if (quantizer != nullptr) {
+			quantizer->prepare(query->data(), code_state);
+		}
+	}
+
+	// squared distance between the query and the reconstruction of codes
+	float code_distance(const uint8_t *codes, float threshold) const {
+		return quantizer->distance(code_state, codes, threshold);
+	}
+
+	void reset() {
+		distance_computation = 0;
+		visit_count = 0;
+		leaf_count = 0;
+		pruned_count = 0;
+		STATS(stats = QueryStats());
+	}
 
 public:
-	Query(DataPoint *query): query(query), results(new ResultContainer<T>(*this)), distance_computation(0), visit_count(0) {}
-	
-	~Query() {
-		delete results;
+	// to be set before scanning leaves stored as codes
+	void set_quantizer(const Quantizer *quantizer) {
+		if (quantizer == this->quantizer) {
+			return;
+		}
+		this->quantizer = quantizer;
+		if (quantizer != nullptr && query != nullptr) {
+			quantizer->prepare(query->data(), code_state);
+		}
 	}
 
-	void set_query(DataPoint *query) {
-		this->clear();
-		this->query = query;
-		results->set_query(*this);
+	// representation of the query under segmentation
+	const std::vector<float>& get_representation(const Segmentation& segmentation) {
+		segmentation.segment_means(prefix_sums, representation);
+		return representation;
+	}
+
+	// representation under segmentation, when the last representation
+	// was computed for the segmentation it was split from at index
+	const std::vector<float>& split_representation(const Segmentation& segmentation, size_t index) {
+		segmentation.split_segment_means(prefix_sums, index, representation);
+		return representation;
 	}
 	
 	DataPoint& get_query() const {
 		return *query;
 	}
 
-	void add_result(DataPoint *point) {
-		results->insert(point);
-	}
-	
 	size_t get_distance_computation() const {
 		return distance_computation;
 	}
@@ -66,100 +153,487 @@ public:
 		return visit_count;
 	}
 
-	DataPoint* best_result() const {
-		return results->best_result();
+	size_t get_leaf_count() const {
+		return leaf_count;
 	}
-	
+
+	size_t get_pruned_count() const {
+		return pruned_count;
+	}
+
+#ifdef QUERY_STATS_ENABLED
+	QueryStats& get_stats() {
+		return stats;
+	}
+	const QueryStats& get_stats() const {
+		return stats;
+	}
+#endif
+
+	// fraction of the dataset whose distance was never computed
+	float pruning_ratio(size_t dataset_size) const {
+		if (dataset_size == 0) {
+			return 0.0f;
+		}
+		return 1.0f - static_cast<float>(distance_computation) / dataset_size;
+	}
+
 	void increment_distance_computation() {
 		distance_computation++;
 	}
 	void increment_visit_count() {
 		visit_count++;
 	}
+	void increment_leaf_count() {
+		leaf_count++;
+	}
+	void add_pruned_count(size_t count) {
+		pruned_count += count;
+	}
+};
+
+
+template<typename T = EuclideanDistance>
+class Query: public QueryBase {
+private:
+	T metric;
+	ResultContainer<T> *results;
+	// smallest lower bound among the nodes the search did not explore
+	float unexplored_bound;
+
+	// point ranked by its code distance, kept with its
+	// float vector for the final re-ranking
+	struct Candidate {
+		float distance;
+		PointId id;
+		const float *point;
+
+		bool operator<(const Candidate& other) const {
+			return distance < other.distance;
+		}
+	};
+
+	// when set, points are ranked by their code distances alone and the
+	// rerank best candidates, kept in a bounded max-heap, are re-ranked
+	// on their float vectors once the search is over
+	bool rank_by_codes;
+	size_t rerank;
+	std::vector<Candidate> candidates;
+
+	// workers reading leaves ahead of the search, if any
+	THREADS::Prefetcher *prefetcher;
+
+	// state shared by the threads scanning leaves of this query
+	THREADS::ScanPool *scan_pool;
+	std::mutex shared_mtx;
+	std::atomic<float> shared_kth_distance;
+	std::atomic<float> shared_candidate_distance;
+
+	float candidate_distance() const {
+		if (rerank == 0 || candidates.size() < rerank) {
+			return std::numeric_limits<float>::max();
+		}
+		return candidates.front().distance;
+	}
+
+	void insert_candidate(float distance, PointId id, const float *point) {
+		if (candidates.size() < rerank) {
+			candidates.push_back({distance, id, point});
+			std::push_heap(candidates.begin(), candidates.end());
+		}
+		else if (distance < candidates.front().distance) {
+			std::pop_heap(candidates.begin(), candidates.end());
+			candidates.back() = {distance, id, point};
+			std::push_heap(candidates.begin(), candidates.end());
+		}
+	}
+
+	// a code distance past this threshold cannot be ranked
+	float ranking_threshold() const {
+		return rerank > 0? candidate_distance(): results->kth_distance();
+	}
+
+	void rank(float distance, PointId id, const float *point) {
+		results->insert(distance, id);
+		if (rerank > 0) {
+			insert_candidate(distance, id, point);
+		}
+	}
+
+	// candidates that cannot enter the results are rejected without the lock
+	void insert_shared(float distance, PointId id) {
+		if (distance >= shared_kth_distance.load(std::memory_order_relaxed)) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(shared_mtx);
+		if (results->insert(distance, id)) {
+			shared_kth_distance.store(results->kth_distance(), std::memory_order_relaxed);
+		}
+	}
+
+public:
+	Query(DataPoint *query, size_t k = 1): QueryBase(query), results(new ResultContainer<T>(k)), unexplored_bound(std::numeric_limits<float>::max()), rank_by_codes(false), rerank(0), prefetcher(nullptr), scan_pool(nullptr), shared_kth_distance(std::numeric_limits<float>::max()), shared_candidate_distance(std::numeric_limits<float>::max()) {
+	}
+	Query(const Query&) = delete;
+	
+	~Query() {
+		delete results;
+	}
+
+	void set_query(DataPoint *query) {
+		this->clear();
+		this->query = query;
+		compute_prefix_sums();
+	}
+
+	// the distance to the query is computed once per candidate
+	void add_result(const float *point, PointId id) {
+		increment_distance_computation();
+		results->insert(metric(point, query->data(), query->size(), results->kth_distance()), id);
+	}
+
+	// the count first points of a group of the grouped leaf layout
+	void add_group(const float *group, const PointId *ids, size_t count) {
+		float distances[SIMD::POINT_GROUP];
+		distance_computation += count;
+		metric.group(query->data(), group, query->size(), distances, results->kth_distance());
+		for (size_t p = 0; p < count; p++) {
+			results->insert(distances[p], ids[p]);
+		}
+	}
+	
+	// ranks the points stored as codes by their code distances, the
+	// results are then approximate. with a non zero rerank, that many
+	// candidates (at least k) are re-ranked by rerank_candidates
+	void set_code_ranking(bool enabled, size_t rerank) {
+		rank_by_codes = enabled;
+		this->rerank = rerank == 0? 0: std::max(rerank, results->capacity());
+		candidates.reserve(this->rerank);
+	}
+
+	// replaces the code distances of the results with the float
+	// distances of the best candidates of a search ranked by codes
+	void rerank_candidates() {
+		if (!rank_by_codes || candidates.empty()) {
+			return;
+		}
+		results->clear();
+		for (const Candidate& candidate: candidates) {
+			add_result(candidate.point, candidate.id);
+		}
+		candidates.clear();
+	}
+
+	// point stored with its codes, the float vector is only read when the
+	// code distance cannot rule the point out. error is the distance between
+	// the point and its reconstruction
+	void add_coded(const uint8_t *codes, float error, const float *point, PointId id) {
+		if (rank_by_codes) {
+			// the code distance is the distance the point is ranked with
+			increment_distance_computation();
+			float distance = code_distance(codes, ranking_threshold());
+			rank(distance, id, point);
+			return;
+		}
+		float threshold = Quantizer::threshold(results->kth_distance(), error);
+		if (code_distance(codes, threshold) < threshold) {
+			add_result(point, id);
+		}
+	}
+
+	// thread safe version of add_result
+	void add_result_shared(const float *point, PointId id) {
+		float distance = metric(point, query->data(), query->size(), shared_kth_distance.load(std::memory_order_relaxed));
+		insert_shared(distance, id);
+	}
+
+	// thread safe version of add_coded, returns whether a distance the
+	// point is ranked with was computed: its code distance when ranking
+	// by codes, otherwise whether the float vector was read
+	bool add_coded_shared(const uint8_t *codes, float error, const float *point, PointId id) {
+		if (rank_by_codes) {
+			float limit = rerank > 0? shared_candidate_distance.load(std::memory_order_relaxed): shared_kth_distance.load(std::memory_order_relaxed);
+			float distance = code_distance(codes, limit);
+			if (distance < limit) {
+				std::lock_guard<std::mutex> lock(shared_mtx);
+				rank(distance, id, point);
+				shared_kth_distance.store(results->kth_distance(), std::memory_order_relaxed);
+				shared_candidate_distance.store(candidate_distance(), std::memory_order_relaxed);
+			}
+			return true;
+		}
+		float threshold = Quantizer::threshold(shared_kth_distance.load(std::memory_order_relaxed), error);
+		if (code_distance(codes, threshold) >= threshold) {
+			return false;
+		}
+		add_result_shared(point, id);
+		return true;
+	}
+
+	// thread safe version of add_group
+	void add_group_shared(const float *group, const PointId *ids, size_t count) {
+		float distances[SIMD::POINT_GROUP];
+		metric.group(query->data(), group, query->size(), distances, shared_kth_distance.load(std::memory_order_relaxed));
+		for (size_t p = 0; p < count; p++) {
+			insert_shared(distances[p], ids[p]);
+		}
+	}
+
+	// start of a concurrent scan, the shared threshold
+	// starts from the current k-th best distance
+	void begin_shared() {
+		shared_kth_distance.store(results->kth_distance(), std::memory_order_relaxed);
+		shared_candidate_distance.store(candidate_distance(), std::memory_order_relaxed);
+	}
+
+	float get_shared_kth_distance() const {
+		return shared_kth_distance.load(std::memory_order_relaxed);
+	}
+
+	void add_shared_counts(size_t leaves, size_t distances) {
+		std::lock_guard<std::mutex> lock(shared_mtx);
+		leaf_count += leaves;
+		distance_computation += distances;
+	}
+
+#ifdef QUERY_STATS_ENABLED
+	// statistics of a leaf scanned concurrently with others, reached with
+	// a lower bound of bound. the times of the threads add up, so the scan
+	// share of the total time may exceed 1
+	void add_shared_stats(const QueryStats& leaf, float bound) {
+		std::lock_guard<std::mutex> lock(shared_mtx);
+		stats.leaves_read += leaf.leaves_read;
+		stats.bytes_read += leaf.bytes_read;
+		stats.io_time += leaf.io_time;
+		stats.scan_time += leaf.scan_time;
+		stats.record_scan(bound, best_distance());
+	}
+#endif
+
+	void add_shared_unexplored(float bound) {
+		std::lock_guard<std::mutex> lock(shared_mtx);
+		pruned_count++;
+		STATS(stats.leaves_pruned++);
+		add_unexplored_bound(bound);
+	}
+
+	void set_scan_pool(THREADS::ScanPool *scan_pool) {
+		this->scan_pool = scan_pool;
+	}
+
+	THREADS::ScanPool* get_scan_pool() const {
+		return scan_pool;
+	}
+
+	void set_prefetcher(THREADS::Prefetcher *prefetcher) {
+		this->prefetcher = prefetcher;
+	}
+
+	THREADS::Prefetcher* get_prefetcher() const {
+		return prefetcher;
+	}
+
+	void add_unexplored_bound(float bound) {
+		unexplored_bound = std::min(unexplored_bound, bound);
+	}
+
+	// lower bound of the true k-th nearest neighbor distance: either every
+	// true neighbor was scanned, or one lies in an unexplored node. points
+	// ranked by codes may have been dropped on an approximate distance,
+	// there is no guarantee left and the bound is 0
+	float achieved_bound() const {
+		if (rank_by_codes) {
+			return 0.0f;
+		}
+		return std::min(kth_distance(), unexplored_bound);
+	}
+
+	// the k-th result is within (1 + epsilon) of the true k-th
+	// nearest neighbor distance (squared), 0 when exact, infinity
+	// without a guarantee
+	float achieved_epsilon() const {
+		float bound = achieved_bound();
+		if (bound <= 0.0f) {
+			return kth_distance() > 0.0f? std::numeric_limits<float>::infinity(): 0.0f;
+		}
+		return kth_distance() / bound - 1.0f;
+	}
+
+	// closest result, null when nothing was found
+	const Result* best_result() const {
+		return results->best_result();
+	}
 
+	// distance to the closest result, infinity when nothing was found
+	float best_distance() const {
+		const Result *best = results->best_result();
+		return best == nullptr? std::numeric_limits<float>::max(): best->distance;
+	}
+
+	// distance to the current k-th best result,
+	// infinity while fewer than k results were found
+	float kth_distance() const {
+		return results->kth_distance();
+	}
+	
 	const ResultContainer <T>* get_results() const {
 		return results;
 	}
 
+	const T& get_metric() const {
+		return metric;
+	}
+
 	void clear() {
 		delete query;
 		query = nullptr;
 		results->clear();
-		distance_computation = 0;
-		visit_count = 0;
+		candidates.clear();
+		reset();
+		unexplored_bound = std::numeric_limits<float>::max();
 	}
 };
 
 
-
-template <typename T = EuclideanDistance>
-class DataPointComparator {
+// all the points within radius of the query, results are appended to a
+// growable output in scan order, distances are squared like the radius
+// bound of the nodes
+template<typename T = EuclideanDistance>
+class RangeQuery: public QueryBase {
 private:
 	T metric;
-	Query<T> &query;
+	float squared_radius;
+	// smallest float above the squared radius, a distance computation
+	// abandoned at this threshold is outside the ball
+	float threshold;
+	std::vector<Result> results;
+#ifdef QUERY_STATS_ENABLED
+	float closest = std::numeric_limits<float>::max();
+#endif
+
 public:
-	DataPointComparator(Query<T>& query): query(query) {}
-	DataPointComparator(const DataPointComparator& other): metric(other.metric), query(other.query) {}
-	DataPointComparator& operator=(const DataPointComparator& other) {
-		if (this != &other) {
-			this->metric = other.metric;
-			this->query = other.query;
+	RangeQuery(DataPoint *query, float radius): QueryBase(query), squared_radius(radius * radius), threshold(std::nextafter(radius * radius, std::numeric_limits<float>::infinity())) {
+	}
+	RangeQuery(const RangeQuery&) = delete;
+
+	void add_result(const float *point, PointId id) {
+		increment_distance_computation();
+		float distance = metric(point, query->data(), query->size(), threshold);
+		if (distance <= squared_radius) {
+			results.push_back({distance, id});
+			STATS(closest = std::min(closest, distance));
 		}
-		return *this;
 	}
-	bool operator() (const DataPoint *a, const DataPoint *b) {
-		query.increment_distance_computation();
-		return metric(*a, query.get_query()) < metric(*b, query.get_query());
+
+	// point stored with its codes, see Query::add_coded
+	void add_coded(const uint8_t *codes, float error, const float *point, PointId id) {
+		float code_threshold = Quantizer::threshold(squared_radius, error);
+		if (code_distance(codes, code_threshold) < code_threshold) {
+			add_result(point, id);
+		}
+	}
+
+	// the count first points of a group of the grouped leaf layout
+	void add_group(const float *group, const PointId *ids, size_t count) {
+		float distances[SIMD::POINT_GROUP];
+		distance_computation += count;
+		metric.group(query->data(), group, query->size(), distances, threshold);
+		for (size_t p = 0; p < count; p++) {
+			if (distances[p] <= squared_radius) {
+				results.push_back({distances[p], ids[p]});
+				STATS(closest = std::min(closest, distances[p]));
+			}
+		}
 	}
 
+	float get_squared_radius() const {
+		return squared_radius;
+	}
+
+	const std::vector<Result>& get_results() const {
+		return results;
+	}
+
+#ifdef QUERY_STATS_ENABLED
+	// distance to the closest result, infinity when nothing was found
+	float best_distance() const {
+		return closest;
+	}
+#endif
+
 	const T& get_metric() const {
 		return metric;
 	}
+
+	void clear() {
+		delete query;
+		query = nullptr;
+		results.clear();
+		STATS(closest = std::numeric_limits<float>::max());
+		reset();
+	}
 };
 
+
+// bounded max-heap keeping the k closest results,
+// the root of the heap is the current k-th best result
 template <typename T = EuclideanDistance>
 class ResultContainer {
 private:
-	DataPointComparator<T> comparator;
-	std::vector<DataPoint *> results;
-	Query<T>& query;
+	std::vector<Result> results;
 	size_t k;
 public:
-	ResultContainer(Query<T>& query, size_t k = 1): comparator(query), query(query), k(k) {}
+	ResultContainer(size_t k = 1): k(k == 0? 1: k) {
+		results.reserve(this->k);
+	}
 
-	void insert(DataPoint *point) {
-		if (point == nullptr) {
-			return;
+	bool insert(float distance, PointId id) {
+		if (results.size() < k) {
+			results.push_back({distance, id});
+			std::push_heap(results.begin(), results.end());
+			return true;
 		}
-		results.push_back(point);
-		std::sort(results.begin(), results.end(), comparator);
-		if (results.size() > k) {
-			results.pop_back();	
+		if (distance >= results.front().distance) {
+			return false;
 		}
+		// replace the current k-th best result
+		std::pop_heap(results.begin(), results.end());
+		results.back() = {distance, id};
+		std::push_heap(results.begin(), results.end());
+		return true;
 	}
-	DataPoint* best_result() const {
+
+	const Result* best_result() const {
 		if (results.empty()) {
 			return nullptr;
 		}
-		return results[0];
+		return &*std::min_element(results.begin(), results.end());
 	}
 
-	void clear() {
-		results.clear();
+	float kth_distance() const {
+		if (results.size() < k) {
+			return std::numeric_limits<float>::max();
+		}
+		return results.front().distance;
 	}
 
-	void set_query(Query<T>& query) {
-		this->query = query;
-		this->comparator = DataPointComparator<T>(query);
-		this->clear();
+	// results ordered by increasing distance
+	std::vector<Result> sorted() const {
+		std::vector<Result> sorted_results(results);
+		std::sort_heap(sorted_results.begin(), sorted_results.end());
+		return sorted_results;
+	}
 
+	void clear() {
+		results.clear();
 	}
+
 	size_t size() const {
 		return results.size();
 	}
 
-	const DataPointComparator<T>& get_comparator() const {
-		return comparator;
+	size_t capacity() const {
+		return k;
 	}
 };
 
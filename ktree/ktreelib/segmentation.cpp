@@ -59,6 +59,30 @@ void Segmentation::split_segment(size_t index) {
 	right_indices.insert(right_indices.begin() + index, mid);
 }
 
+void Segmentation::segment_means(const std::vector<double>& prefix_sums, std::vector<float>& means) const {
+	means.resize(right_indices.size());
+	size_t start = 0;
+	for (size_t i = 0; i < right_indices.size(); i++) {
+		size_t end = right_indices[i];
+		means[i] = static_cast<float>((prefix_sums[end] - prefix_sums[start]) / (end - start));
+		start = end;
+	}
+}
+
+void Segmentation::split_segment_means(const std::vector<double>& prefix_sums, size_t index, std::vector<float>& means) const {
+	if (means.size() + 1 != right_indices.size() || index + 1 >= right_indices.size()) {
+		segment_means(prefix_sums, means);
+		return;
+	}
+	// shift the following segments, the capacity is kept between calls
+	means.insert(means.begin() + index + 1, 0.0f);
+	for (size_t i = index; i <= index + 1; i++) {
+		size_t start = i == 0? 0: right_indices[i - 1];
+		size_t end = right_indices[i];
+		means[i] = static_cast<float>((prefix_sums[end] - prefix_sums[start]) / (end - start));
+	}
+}
+
 void Segmentation::get_segments_sizes(std::vector<size_t>& holder) const {
 	holder.clear();
 	for (size_t i = 0; i < this->size(); i++) {
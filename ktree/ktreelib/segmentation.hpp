@@ -35,6 +35,12 @@ public:
 	void get_segments_sizes(std::vector<size_t>& holder) const;
 	void split_segment(size_t index);
 
+	// average of a point over each segment, from the point's prefix sums
+	void segment_means(const std::vector<double>& prefix_sums, std::vector<float>& means) const;
+	// turns the means under the segmentation this one was split from
+	// into the means under this one, only the two halves are computed
+	void split_segment_means(const std::vector<double>& prefix_sums, size_t index, std::vector<float>& means) const;
+
 	// serialization
 	void serialize(std::ofstream& out) const override;
 	void deserialize(std::ifstream& in) override;
@@ -0,0 +1,75 @@
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+#include "stats.hpp"
+#include "error.hpp"
+
+
+namespace KTREE {
+
+float QueryStats::bound_tightness() const {
+	if (result_distance == std::numeric_limits<float>::max()) {
+		return 0.0f;
+	}
+	if (result_distance <= 0.0f) {
+		return 1.0f;
+	}
+	// bound and distance are squared
+	return std::sqrt(result_bound / result_distance);
+}
+
+double QueryStats::routing_time() const {
+	return std::max(0.0, total_time - bound_time - io_time - scan_time);
+}
+
+static void write_csv(std::ofstream& out, const std::vector<QueryStats>& stats) {
+	out << "query_id,distance_computations,internal_visited,leaves_visited,leaves_pruned,pruning_ratio,bound_tightness,"
+		<< "leaves_read,bytes_read,total_time,routing_time,bound_time,io_time,scan_time" << std::endl;
+	for (size_t i = 0; i < stats.size(); i++) {
+		const QueryStats& s = stats[i];
+		out << i << "," << s.distance_computations << "," << s.internal_visited << "," << s.leaves_visited
+			<< "," << s.leaves_pruned << "," << s.pruning_ratio << "," << s.bound_tightness()
+			<< "," << s.leaves_read << "," << s.bytes_read << "," << s.total_time << "," << s.routing_time()
+			<< "," << s.bound_time << "," << s.io_time << "," << s.scan_time << std::endl;
+	}
+}
+
+static void write_json(std::ofstream& out, const std::vector<QueryStats>& stats) {
+	out << "[" << std::endl;
+	for (size_t i = 0; i < stats.size(); i++) {
+		const QueryStats& s = stats[i];
+		out << "  {\"query_id\": " << i
+			<< ", \"distance_computations\": " << s.distance_computations
+			<< ", \"internal_visited\": " << s.internal_visited
+			<< ", \"leaves_visited\": " << s.leaves_visited
+			<< ", \"leaves_pruned\": " << s.leaves_pruned
+			<< ", \"pruning_ratio\": " << s.pruning_ratio
+			<< ", \"bound_tightness\": " << s.bound_tightness()
+			<< ", \"leaves_read\": " << s.leaves_read
+			<< ", \"bytes_read\": " << s.bytes_read
+			<< ", \"total_time\": " << s.total_time
+			<< ", \"routing_time\": " << s.routing_time()
+			<< ", \"bound_time\": " << s.bound_time
+			<< ", \"io_time\": " << s.io_time
+			<< ", \"scan_time\": " << s.scan_time
+			<< "}" << (i + 1 < stats.size()? ",": "") << std::endl;
+	}
+	out << "]" << std::endl;
+}
+
+void QueryStats::write(const std::string& path, const std::vector<QueryStats>& stats) {
+	std::ofstream out(path);
+	if (!out.is_open()) {
+		throw KTreeError("Failed to open stats file for writing: " + path);
+	}
+	const std::string json = ".json";
+	if (path.size() >= json.size() && path.compare(path.size() - json.size(), json.size(), json) == 0) {
+		write_json(out, stats);
+	}
+	else {
+		write_csv(out, stats);
+	}
+}
+
+};
@@ -0,0 +1,90 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <chrono>
+
+// the per query statistics are only accumulated when built with
+// QUERY_STATS_ENABLED, otherwise every STATS statement is compiled out
+#ifdef QUERY_STATS_ENABLED
+#define STATS(statement) statement
+// value of expression, its duration added to seconds
+#define STATS_TIMED(seconds, expression) KTREE::timed(seconds, [&]() { return expression; })
+#else
+#define STATS(statement)
+#define STATS_TIMED(seconds, expression) (expression)
+#endif
+
+namespace KTREE {
+
+// execution statistics of one query
+struct QueryStats {
+	size_t internal_visited = 0;
+	size_t leaves_visited = 0;
+	size_t leaves_pruned = 0;
+	size_t distance_computations = 0;
+	float pruning_ratio = 0.0f;
+
+	// leaves loaded from storage on a buffer pool miss of the search,
+	// leaves read ahead by the prefetch workers are not included
+	size_t leaves_read = 0;
+	size_t bytes_read = 0;
+
+	// squared lower bound of the scanned leaf that held the closest
+	// result, and the squared distance of that result
+	float result_bound = 0.0f;
+	float result_distance = std::numeric_limits<float>::max();
+
+	// seconds
+	double total_time = 0.0;
+	double bound_time = 0.0;
+	double io_time = 0.0;
+	double scan_time = 0.0;
+
+	// a leaf whose lower bound was bound was scanned, distance is the
+	// closest result found so far
+	void record_scan(float bound, float distance) {
+		if (distance < result_distance) {
+			result_distance = distance;
+			result_bound = bound;
+		}
+	}
+
+	// lower bound over the true distance of the closest result,
+	// 1 for a perfectly tight bound, 0 without results
+	float bound_tightness() const;
+
+	// time spent outside of the bounds, the leaf reads and the
+	// leaf scans: walking down the tree and the queue of the search
+	double routing_time() const;
+
+	// writes the statistics of every query as JSON when path ends with
+	// .json, as CSV otherwise
+	static void write(const std::string& path, const std::vector<QueryStats>& stats);
+};
+
+// adds its lifetime to seconds
+class StatsTimer {
+private:
+	double& seconds;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit StatsTimer(double& seconds): seconds(seconds), start(std::chrono::steady_clock::now()) {}
+	StatsTimer(const StatsTimer&) = delete;
+	~StatsTimer() {
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+template<typename F>
+auto timed(double& seconds, F f) -> decltype(f()) {
+	StatsTimer timer(seconds);
+	return f();
+}
+
+};
+
+#endif // __STATS_HPP__
@@ -2,39 +2,41 @@
 
 #ifdef MULTITHREADED_ENABLED
 
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
 #include "utils.hpp"
+#include "ktree.hpp"
 
 namespace THREADS {
 
-void TaskQueue::push(KTREE::Node *node) {
-	std::lock_guard<std::mutex> lock(mtx);
-	queue.push(node);
-	cv_.notify_all();
-}
-
-KTREE::Node *TaskQueue::pop() {
-	std::unique_lock<std::mutex> lock(mtx);
-	cv_.wait(lock, [this] { return !queue.empty(); });
-	KTREE::Node *node = queue.front();
-	queue.pop();
-	return node;
-}
-
-bool TaskQueue::is_empty() {
-	std::lock_guard<std::mutex> lock(mtx);
-	return queue.empty();
-}
+// set on the threads of a build pool
+static thread_local ThreadPool *current_pool = nullptr;
 
-ThreadPool::ThreadPool(size_t num_threads): stop(false), active_tasks(0) {
+ThreadPool::ThreadPool(size_t num_threads, bool pin_threads): pending(0), queued(0), next_deque(0), stop(false) {
 	if (num_threads == 0) {
-		num_threads = std::thread::hardware_concurrency();
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
 	}
 	for (size_t i = 0; i < num_threads; i++) {
-		workers.push_back(std::thread(&ThreadPool::worker, this));
+		deques.push_back(std::unique_ptr<Worker>(new Worker()));
+	}
+	for (size_t i = 0; i < num_threads; i++) {
+		workers.push_back(std::thread(&ThreadPool::worker, this, i));
+		if (pin_threads) {
+			pin(i);
+		}
 	}
 }
 
 ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(idle_mtx);
+		stop = true;
+	}
+	idle_cv.notify_all();
 	for (auto& worker: workers) {
 		if (worker.joinable()) {
 			worker.join();
@@ -42,53 +44,295 @@ ThreadPool::~ThreadPool() {
 	}
 }
 
-void ThreadPool::add_task(KTREE::Node *node) {
-	{
-		std::lock_guard<std::mutex> lock(mtx);
-		active_tasks++;
+void ThreadPool::pin(size_t index) {
+#ifdef __linux__
+	// the cores the process may run on, in order
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
 	}
-	queue.push(node);
+	std::vector<int> cores;
+	for (int core = 0; core < CPU_SETSIZE; core++) {
+		if (CPU_ISSET(core, &allowed)) {
+			cores.push_back(core);
+		}
+	}
+	if (cores.empty()) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cores[index % cores.size()], &set);
+	if (pthread_setaffinity_np(workers[index].native_handle(), sizeof(set), &set) != 0) {
+		LOG("Failed to pin build thread " << index);
+	}
+#endif
+}
+
+void ThreadPool::add_task(KTREE::Node *node) {
+	pending++;
+	// nodes from outside of the workers are spread over the deques
+	push(next_deque++ % deques.size(), node);
 }
 
 bool ThreadPool::has_active_tasks() {
-	std::lock_guard<std::mutex> lock(mtx);
-	return active_tasks > 0;
+	return pending > 0;
 }
 
-void ThreadPool::worker() {
-	std::thread::id this_id = std::this_thread::get_id();
-	
-	while (true) {
-		KTREE::Node* node = queue.pop();
-		if (node == nullptr)
-			break;
-		node->split(node->getNum_points());
-		if (node->getLeft() != nullptr) {
-			add_task(node->getLeft());
+void ThreadPool::push(size_t index, KTREE::Node *node) {
+	{
+		std::lock_guard<std::mutex> lock(deques[index]->mtx);
+		deques[index]->tasks.push_back(node);
+	}
+	queued++;
+	// a worker checking queued under idle_mtx either sees the node
+	// or is already waiting when notified
+	{
+		std::lock_guard<std::mutex> lock(idle_mtx);
+	}
+	idle_cv.notify_one();
+}
+
+KTREE::Node *ThreadPool::take(size_t index) {
+	{
+		// newest node of its own deque, the deepest one
+		Worker& own = *deques[index];
+		std::lock_guard<std::mutex> lock(own.mtx);
+		if (!own.tasks.empty()) {
+			KTREE::Node *node = own.tasks.back();
+			own.tasks.pop_back();
+			queued--;
+			return node;
 		}
-		if (node->getRight() != nullptr) {
-			add_task(node->getRight());
+	}
+	for (size_t i = 1; i < deques.size(); i++) {
+		// oldest node of another deque, the largest subtree
+		Worker& victim = *deques[(index + i) % deques.size()];
+		std::lock_guard<std::mutex> lock(victim.mtx);
+		if (!victim.tasks.empty()) {
+			KTREE::Node *node = victim.tasks.front();
+			victim.tasks.pop_front();
+			queued--;
+			return node;
 		}
+	}
+	return nullptr;
+}
+
+size_t ThreadPool::size() const {
+	return workers.size();
+}
+
+ThreadPool* ThreadPool::current() {
+	return current_pool;
+}
+
+void ThreadPool::run(Batch& batch) {
+	size_t i;
+	while ((i = batch.next++) < batch.n) {
+		(*batch.fn)(i);
+		if (++batch.done == batch.n) {
+			std::lock_guard<std::mutex> lock(batch.mtx);
+			batch.cv.notify_all();
+		}
+	}
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+	if (n == 0) {
+		return;
+	}
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>(n, &fn);
+	size_t count = std::min(n - 1, workers.size() - 1);
+	if (count > 0) {
 		{
-			std::lock_guard<std::mutex> lock(mtx);
-			active_tasks--;
+			std::lock_guard<std::mutex> lock(idle_mtx);
+			helpers.insert(helpers.end(), count, batch);
+		}
+		idle_cv.notify_all();
+	}
+
+	run(*batch);
+
+	// a helper still running an iteration references fn, a helper
+	// starting later finds no iteration left and leaves fn alone
+	std::unique_lock<std::mutex> lock(batch->mtx);
+	batch->cv.wait(lock, [&batch] { return batch->done == batch->n; });
+}
+
+void ThreadPool::worker(size_t index) {
+	current_pool = this;
+	while (true) {
+		KTREE::Node *node = take(index);
+		if (node == nullptr) {
+			std::shared_ptr<Batch> batch;
+			{
+				std::unique_lock<std::mutex> lock(idle_mtx);
+				idle_cv.wait(lock, [this] { return stop || queued > 0 || !helpers.empty(); });
+				if (stop) {
+					break;
+				}
+				if (!helpers.empty()) {
+					batch = std::move(helpers.front());
+					helpers.pop_front();
+				}
+			}
+			if (batch) {
+				run(*batch);
+			}
+			continue;
+		}
+		while (node != nullptr) {
+			node->split(node->getNum_points());
+			KTREE::Node *left = node->getLeft();
+			KTREE::Node *right = node->getRight();
+			// children are counted before their parent is done
+			if (left != nullptr && right != nullptr) {
+				pending++;
+				push(index, right);
+				right = nullptr;
+			}
+			node = left != nullptr? left: right;
+			if (node == nullptr && --pending == 0) {
+				std::lock_guard<std::mutex> lock(done_mtx);
+				done_cv.notify_all();
+			}
 		}
 	}
 }
 
 void ThreadPool::wait_for_completion() {
+	std::unique_lock<std::mutex> lock(done_mtx);
+	done_cv.wait(lock, [this] { return pending == 0; });
+}
+
+ScanPool::ScanPool(size_t num_threads): stop(false) {
+	for (size_t i = 0; i < num_threads; i++) {
+		workers.push_back(std::thread(&ScanPool::worker, this));
+	}
+}
+
+ScanPool::~ScanPool() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	cv_.notify_all();
+	for (auto& worker: workers) {
+		if (worker.joinable()) {
+			worker.join();
+		}
+	}
+}
+
+size_t ScanPool::size() const {
+	return workers.size();
+}
+
+void ScanPool::worker() {
 	while (true) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_.wait(lock, [this] { return stop || !jobs.empty(); });
+			if (stop && jobs.empty()) {
+				break;
+			}
+			job = std::move(jobs.front());
+			jobs.pop();
+		}
+		job();
+	}
+}
+
+void ScanPool::parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+	if (n == 0) {
+		return;
+	}
+	std::atomic<size_t> next(0);
+	size_t pending = std::min(n - 1, workers.size());
+	std::mutex batch_mtx;
+	std::condition_variable batch_cv;
+
+	auto run = [&next, &fn, n]() {
+		size_t i;
+		while ((i = next++) < n) {
+			fn(i);
+		}
+	};
 
-		if (!has_active_tasks() && queue.is_empty()) {
-			for (auto& worker: workers) {
-				this->add_task(nullptr);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (size_t i = 0; i < pending; i++) {
+			jobs.push([&run, &pending, &batch_mtx, &batch_cv]() {
+				run();
+				std::lock_guard<std::mutex> lock(batch_mtx);
+				if (--pending == 0) {
+					batch_cv.notify_one();
+				}
+			});
+		}
+	}
+	cv_.notify_all();
+
+	run();
+
+	// helpers reference this frame, wait until all of them are done
+	std::unique_lock<std::mutex> lock(batch_mtx);
+	batch_cv.wait(lock, [&pending] { return pending == 0; });
+}
+
+Prefetcher::Prefetcher(size_t num_threads): stop(false), issued(0), completed(0), cancelled(0) {
+	for (size_t i = 0; i < num_threads; i++) {
+		workers.push_back(std::thread(&Prefetcher::worker, this));
+	}
+}
+
+Prefetcher::~Prefetcher() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	cv_.notify_all();
+	for (auto& worker: workers) {
+		if (worker.joinable()) {
+			worker.join();
+		}
+	}
+}
+
+void Prefetcher::submit(const KTREE::Node *node, float bound, const std::shared_ptr<Ticket>& ticket) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		requests.push_back({node, bound, ticket});
+	}
+	issued++;
+	cv_.notify_one();
+}
+
+void Prefetcher::worker() {
+	while (true) {
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_.wait(lock, [this] { return stop || !requests.empty(); });
+			if (stop) {
+				break;
 			}
-			break;
+			request = std::move(requests.front());
+			requests.pop_front();
+		}
+		// the search finished or pruned the leaf in the meantime
+		if (request.ticket->closed.load(std::memory_order_relaxed) || request.bound >= request.ticket->threshold.load(std::memory_order_relaxed)) {
+			cancelled++;
+			continue;
 		}
+		request.node->prefetch();
+		completed++;
 	}
 }
 
 };
 
-#endif
\ No newline at end of file
+#endif
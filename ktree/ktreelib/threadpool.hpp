@@ -7,41 +7,163 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <limits>
+#include <memory>
 
-#include "ktree.hpp"
+namespace KTREE {
+class Node;
+}
 
 namespace THREADS {
 
-class TaskQueue {
+// work stealing scheduler of the nodes to split while building the tree.
+// every worker owns a deque: it goes on with one child of the node it split
+// and pushes the other to the back of its deque, so it works depth first on
+// files it just wrote. an idle worker takes from the back of its deque, then
+// steals from the front of the others, where the largest subtrees are.
+// a worker fitting a large node spreads its blocks over the idle workers
+// with parallel_for, near the root most of them have nothing else to do
+class ThreadPool {
+private:
+	struct Worker {
+		std::deque<KTREE::Node *> tasks;
+		std::mutex mtx;
+	};
+
+	// iterations of a parallel_for, shared with the helpers that may
+	// only start once every iteration is done
+	struct Batch {
+		std::atomic<size_t> next;
+		std::atomic<size_t> done;
+		size_t n;
+		const std::function<void(size_t)> *fn;
+		std::mutex mtx;
+		std::condition_variable cv;
+
+		Batch(size_t n, const std::function<void(size_t)> *fn): next(0), done(0), n(n), fn(fn) {}
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Worker>> deques;
+
+	// nodes added and not split yet, and nodes waiting in a deque
+	std::atomic<size_t> pending;
+	std::atomic<size_t> queued;
+	std::atomic<size_t> next_deque;
+
+	// idle workers sleep until a node or a parallel_for helper is queued,
+	// the helpers are guarded by idle_mtx
+	std::mutex idle_mtx;
+	std::condition_variable idle_cv;
+	std::deque<std::shared_ptr<Batch>> helpers;
+	// wait_for_completion sleeps until pending reaches 0
+	std::mutex done_mtx;
+	std::condition_variable done_cv;
+	bool stop;
+
+public:
+	// 0 threads uses every core, pinned threads are bound to one of
+	// the cores the process may run on each
+	ThreadPool(size_t num_threads = 0, bool pin_threads = false);
+	~ThreadPool();
+
+	void add_task(KTREE::Node *node);
+	bool has_active_tasks();
+
+	// returns once every node added, and their children, are split
+	void wait_for_completion();
+
+	size_t size() const;
+
+	// runs fn(0) ... fn(n - 1), the calling worker takes part and the idle
+	// workers help, the call returns once every iteration is done
+	void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+	// pool of the calling build worker, null on any other thread
+	static ThreadPool* current();
+
 private:
-	std::queue<KTREE::Node *> queue;
+	static void run(Batch& batch);
+	void push(size_t index, KTREE::Node *node);
+	KTREE::Node *take(size_t index);
+	void worker(size_t index);
+	void pin(size_t index);
+};
+
+// persistent workers helping a caller run the iterations of a loop,
+// used to scan several leaves of the same query at the same time
+class ScanPool {
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
 	std::mutex mtx;
 	std::condition_variable cv_;
+	bool stop;
+
 public:
-	TaskQueue() = default;
-	~TaskQueue() = default;
+	ScanPool(size_t num_threads);
+	~ScanPool();
 
-	void push(KTREE::Node *node);
-	KTREE::Node *pop();
-	bool is_empty();
+	size_t size() const;
+
+	// runs fn(0) ... fn(n - 1), the calling thread takes part
+	// and the call returns once every iteration is done
+	void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+private:
+	void worker();
 };
 
-class ThreadPool {
+// background workers reading the leaves a search is about to scan,
+// so that the reads overlap with the scans of the current leaves
+class Prefetcher {
+public:
+	// reads requested by one search, a read whose bound reached
+	// the threshold of its ticket is dropped
+	struct Ticket {
+		std::atomic<float> threshold;
+		std::atomic<bool> closed;
+
+		Ticket(): threshold(std::numeric_limits<float>::max()), closed(false) {}
+	};
+
 private:
+	struct Request {
+		const KTREE::Node *node;
+		float bound;
+		std::shared_ptr<Ticket> ticket;
+	};
+
 	std::vector<std::thread> workers;
-	TaskQueue queue;
-	std::atomic<size_t> active_tasks;
+	std::deque<Request> requests;
 	std::mutex mtx;
+	std::condition_variable cv_;
 	bool stop;
 
+	std::atomic<size_t> issued;
+	std::atomic<size_t> completed;
+	std::atomic<size_t> cancelled;
+
 public:
-	ThreadPool(size_t num_threads = 0);
-	~ThreadPool();
+	Prefetcher(size_t num_threads);
+	~Prefetcher();
 
-	void add_task(KTREE::Node *node);
-	bool has_active_tasks();
+	// queues the read of a leaf, dropped unless bound is still below
+	// the ticket threshold when a worker picks it
+	void submit(const KTREE::Node *node, float bound, const std::shared_ptr<Ticket>& ticket);
 
-	void wait_for_completion();
+	size_t get_issued() const {
+		return issued;
+	}
+	size_t get_completed() const {
+		return completed;
+	}
+	size_t get_cancelled() const {
+		return cancelled;
+	}
 
 private:
 	void worker();
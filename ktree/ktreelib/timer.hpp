@@ -11,14 +11,14 @@ public:
 		if (running) {
 			throw std::runtime_error("Timer is already running");
 		}
-		start_time = std::chrono::high_resolution_clock::now();
+		start_time = std::chrono::steady_clock::now();
 		running = true;
 	}
 	void stop() {
 		if (!running) {
 			throw std::runtime_error("Timer is not running");
 		}
-		end_time = std::chrono::high_resolution_clock::now();
+		end_time = std::chrono::steady_clock::now();
 		running = false;
 	}
 	void reset() {
@@ -26,25 +26,26 @@ public:
 	}
 
 	friend std::ostream& operator<<(std::ostream& out, Timer& timer) {
-		if (timer.running) {
-			throw std::runtime_error("Timer is still running");
-		}
-		auto duration = std::chrono::duration<double>(timer.end_time - timer.start_time);
-		out << duration.count() << "ms";
+		out << timer.to_string();
 		return out;
 	}
 
+	// elapsed time in seconds, with its unit
 	std::string to_string() {
+		return std::to_string(seconds()) + " s";
+	}
+
+	// elapsed seconds
+	double seconds() {
 		if (running) {
 			throw std::runtime_error("Timer is still running");
 		}
-		auto duration = std::chrono::duration<double>(end_time - start_time);
-		return std::to_string(duration.count()) + " s";
+		return std::chrono::duration<double>(end_time - start_time).count();
 	}
 
 private:
-	std::chrono::time_point<std::chrono::high_resolution_clock> start_time;
-	std::chrono::time_point<std::chrono::high_resolution_clock> end_time;
+	std::chrono::time_point<std::chrono::steady_clock> start_time;
+	std::chrono::time_point<std::chrono::steady_clock> end_time;
 	bool running;
 };
 
@@ -6,9 +6,11 @@
 #include <sstream>
 #include <vector>
 #include <iostream>
+#include <cstdint>
 
 #include <numeric>
 #include <algorithm>
+#include <random>
 
 namespace KTREE {
 	
@@ -94,6 +96,94 @@ void compute_variance(const std::vector<V* >& data, std::vector<float>& variance
 	}
 }
 
+// mean and variance of every dimension of a stream of points, with
+// welford's updates, which do not cancel out like the sum of squares
+class RunningVariance {
+private:
+	size_t count;
+	std::vector<double> means;
+	std::vector<double> m2;
+
+public:
+	RunningVariance(size_t dimensions = 0): count(0), means(dimensions, 0.0), m2(dimensions, 0.0) {}
+
+	void add(const float *point) {
+		count++;
+		double inverse = 1.0 / count;
+		for (size_t i = 0; i < means.size(); i++) {
+			double delta = point[i] - means[i];
+			means[i] += delta * inverse;
+			m2[i] += delta * (point[i] - means[i]);
+		}
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	// population variance of every dimension
+	void variance(std::vector<float>& variance) const {
+		variance.resize(means.size());
+		for (size_t i = 0; i < means.size(); i++) {
+			variance[i] = count == 0? 0.0f: static_cast<float>(m2[i] / count);
+		}
+	}
+};
+
+// uniform sample of at most capacity points of a stream, every point
+// seen so far is kept with the same probability (algorithm R)
+class ReservoirSample {
+private:
+	size_t dimensions;
+	size_t capacity;
+	size_t seen;
+	std::vector<float> points;
+	std::mt19937_64 gen;
+
+public:
+	ReservoirSample(size_t dimensions = 0, size_t capacity = 0, uint64_t seed = 0):
+		dimensions(dimensions), capacity(capacity), seen(0), gen(seed) {}
+
+	void add(const float *point) {
+		seen++;
+		if (capacity == 0) {
+			return;
+		}
+		if (points.size() < capacity * dimensions) {
+			points.insert(points.end(), point, point + dimensions);
+			return;
+		}
+		size_t slot = std::uniform_int_distribution<size_t>(0, seen - 1)(gen);
+		if (slot < capacity) {
+			std::copy(point, point + dimensions, points.begin() + slot * dimensions);
+		}
+	}
+
+	// number of sampled points
+	size_t size() const {
+		return dimensions == 0? 0: points.size() / dimensions;
+	}
+
+	// number of points of the stream
+	size_t count() const {
+		return seen;
+	}
+
+	// the sampled points, one after the other
+	const float *data() const {
+		return points.data();
+	}
+};
+
+// splitmix64 finalizer, spreads the seeds derived from a single
+// seed, such as those of the two children of a node
+inline uint64_t mix_seed(uint64_t seed) {
+	seed += 0x9e3779b97f4a7c15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+	return seed ^ (seed >> 31);
+}
+
 template<typename T>
 void argsort(const std::vector<T>& v, std::vector<size_t>& indices) {
 	indices.resize(v.size());
@@ -5,11 +5,6 @@
 #include "ktreelib.hpp"
 
 
-KTREE::Config *KTREE::Config::instance = nullptr;
-std::mutex KTREE::Config::mtx;
-
-
-
 
 int main(int argc, char **argv) {
 	KTREE::Config *config = KTREE::Config::get_instance();
@@ -36,6 +31,16 @@ int main(int argc, char **argv) {
 				index.load();
 				index.search();
 				break;
+			case KTREE::Mode::GROUNDTRUTH: {
+				KTREE::GroundTruth groundtruth;
+				groundtruth.compute(
+					config->dataset, config->dataset_size,
+					config->queries, config->queries_size,
+					config->dimensions, config->k, config->query_threads
+				);
+				groundtruth.save(config->groundtruth);
+				break;
+			}
 		}
 	} catch (std::exception &e) {
 		std::cerr << e.what() << std::endl;